@@ -20,6 +20,18 @@
      misrepresented as being the original software.
   3. This notice may not be removed or altered from any source distribution.
 */
+/* For RTLD_NEXT */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <SDL_config.h>
 
 /* This file contains functions for backwards compatibility with SDL ̶1̶.̶2 1.3 */
@@ -28,6 +40,14 @@
 #include <SDL_syswm.h>
 
 #include "SDL_compat.h"
+#include "SDL_compat_metrics.h"
+
+/* SIMD kernels are built with per-function target attributes and picked
+   at runtime, so the library itself doesn't need -msse2 or -mavx2 */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define HAVE_COMPAT_X86_KERNELS 1
+#include <immintrin.h>
+#endif
 
 static SDL_Window *SDL_VideoWindow = NULL;
 static SDL_Surface *SDL_WindowSurface = NULL;
@@ -35,11 +55,368 @@ static SDL_Surface *SDL_VideoSurface = NULL;
 static SDL_Surface *SDL_ShadowSurface = NULL;
 static SDL_Surface *SDL_PublicSurface = NULL;
 static SDL_GLContext *SDL_VideoContext = NULL;
+static SDL_Renderer *SDL_VideoRenderer = NULL; /* Instead of the window surface */
+static SDL_Texture *SDL_VideoTexture = NULL;
 static Uint32 SDL_VideoFlags = 0;
 static SDL_Rect SDL_VideoViewport;
+static size_t SDL_ShadowCapacity = 0;   /* Bytes the shadow pixels can hold */
+static size_t SDL_VideoCapacity = 0;    /* Same for renderer video pixels */
+static SDL_bool SDL_ResizePending = SDL_FALSE; /* Present all of it next */
+static int SDL_VideoScale = 0;          /* COMPAT_SCALE_* presenting with */
 static char *wm_title = NULL;
 static SDL_Surface *SDL_VideoIcon;
 static int SDL_enabled_UNICODE = 0;
+static Uint32 SDL_VideoModeSerial = 0; /* Bumped whenever the screen changes */
+static SDL_Rect *SDL_UpdateRectsBuffer = NULL;
+static int SDL_UpdateRectsBufferSize = 0;
+static int SDL_UpdateCoverage = 75;     /* Percent dirty to update it all */
+static Uint32 SDL_DeferredPresent = 0;  /* Max ms to hold back updates */
+static SDL_threadID SDL_VideoThread;    /* Thread that set the video mode */
+static SDL_Surface *SDL_PendingScreen = NULL;
+static SDL_Rect *SDL_PendingRects = NULL;
+static int SDL_NumPendingRects = 0;
+static int SDL_PendingRectsSize = 0;
+static Uint32 SDL_PendingSince;
+static SDL_bool SDL_CoalesceMotion = SDL_FALSE; /* Merge runs of motion */
+static float SDL_WheelThreshold = 1.0f;  /* Notches per wheel button click */
+static struct
+{
+    SDL_Thread *thread;         /* Presents SDL_Flip()ed frames */
+    SDL_mutex *present;         /* Held while touching the video surface */
+    SDL_mutex *lock;            /* Protects the buffer indices */
+    SDL_cond *flipped;
+    SDL_Surface *surface;       /* The present thread's source surface */
+    void *buffers[3];
+    size_t capacity[3];         /* Bytes each of our own buffers can hold */
+    void *original;             /* The shadow surface's own pixels */
+    int draw;                   /* The one the application draws into */
+    int ready;                  /* Flipped, but not picked up yet */
+    int shown;                  /* The one on screen */
+    SDL_bool pending;
+    SDL_bool resized;           /* The ready frame is the first at a new size */
+    SDL_bool quit;
+} SDL_Flipper;
+
+/* === Tracing === */
+
+/* Setting SDL_COMPAT_TRACE to a file name records how long each entry point
+ *  takes, into a ring per thread, and writes them out as Chrome trace JSON
+ *  (chrome://tracing, ui.perfetto.dev) at SDL_Quit or on SIGUSR2.
+ *  When it's not set, an entry point costs one test of SDL_TraceEnabled.
+ */
+#define COMPAT_TRACE_RING_SIZE  16384   /* Spans per thread, a power of 2 */
+
+typedef struct
+{
+    const char *name;
+    Uint64 start;
+    Uint64 end;
+} SDL_TraceEntry;
+
+typedef struct SDL_TraceRing
+{
+    struct SDL_TraceRing *next;
+    SDL_threadID thread;
+    SDL_atomic_t written;       /* Spans ever written, wraps harmlessly */
+    SDL_TraceEntry entries[COMPAT_TRACE_RING_SIZE];
+} SDL_TraceRing;
+
+typedef struct
+{
+    const char *name;
+    Uint64 start;               /* 0 when tracing is off */
+} SDL_TraceSpan;
+
+static SDL_bool SDL_TraceEnabled = SDL_FALSE;
+static char *SDL_TracePath = NULL;
+static SDL_TraceRing *SDL_TraceRings = NULL;
+static SDL_SpinLock SDL_TraceRingsLock = 0;
+static volatile sig_atomic_t SDL_TraceDumpRequested = 0;
+static __thread SDL_TraceRing *SDL_TraceLocal = NULL;
+
+static void
+SDL_TraceDump(void)
+{
+    FILE *file;
+    SDL_TraceRing *ring;
+    Uint64 base = 0;
+    double scale;
+    const char *separator = "";
+
+    file = fopen(SDL_TracePath, "w");
+    if (!file) {
+        return;
+    }
+    scale = 1000000.0 / (double) SDL_GetPerformanceFrequency();
+
+    SDL_AtomicLock(&SDL_TraceRingsLock);
+
+    /* Timestamps start at the oldest span we still have */
+    for (ring = SDL_TraceRings; ring; ring = ring->next) {
+        Uint32 written = (Uint32) SDL_AtomicGet(&ring->written);
+        Uint32 first = written - SDL_min(written, COMPAT_TRACE_RING_SIZE);
+
+        if (written && (!base ||
+            ring->entries[first % COMPAT_TRACE_RING_SIZE].start < base)) {
+            base = ring->entries[first % COMPAT_TRACE_RING_SIZE].start;
+        }
+    }
+
+    fprintf(file, "{\"traceEvents\":[");
+    for (ring = SDL_TraceRings; ring; ring = ring->next) {
+        Uint32 written = (Uint32) SDL_AtomicGet(&ring->written);
+        Uint32 i = written - SDL_min(written, COMPAT_TRACE_RING_SIZE);
+
+        for (; i != written; ++i) {
+            const SDL_TraceEntry *entry =
+                &ring->entries[i % COMPAT_TRACE_RING_SIZE];
+
+            fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+                    "\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+                    separator, entry->name, (int) getpid(),
+                    (unsigned long) ring->thread,
+                    (double) (entry->start - base) * scale,
+                    (double) (entry->end - entry->start) * scale);
+            separator = ",";
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    SDL_AtomicUnlock(&SDL_TraceRingsLock);
+    fclose(file);
+}
+
+static void
+SDL_TraceRecord(const SDL_TraceSpan * span)
+{
+    SDL_TraceRing *ring = SDL_TraceLocal;
+    SDL_TraceEntry *entry;
+    Uint32 written;
+
+    if (!ring) {
+        ring = (SDL_TraceRing *) SDL_calloc(1, sizeof(*ring));
+        if (!ring) {
+            return;
+        }
+        ring->thread = SDL_ThreadID();
+        SDL_AtomicLock(&SDL_TraceRingsLock);
+        ring->next = SDL_TraceRings;
+        SDL_TraceRings = ring;
+        SDL_AtomicUnlock(&SDL_TraceRingsLock);
+        SDL_TraceLocal = ring;
+    }
+
+    written = (Uint32) SDL_AtomicGet(&ring->written);
+    entry = &ring->entries[written % COMPAT_TRACE_RING_SIZE];
+    entry->name = span->name;
+    entry->start = span->start;
+    entry->end = SDL_GetPerformanceCounter();
+    SDL_AtomicAdd(&ring->written, 1);
+
+    /* Signal handlers can't do file I/O, so SIGUSR2 just asks for this */
+    if (SDL_TraceDumpRequested) {
+        SDL_TraceDumpRequested = 0;
+        SDL_TraceDump();
+    }
+}
+
+static SDL_INLINE void
+SDL_TraceEnd(const SDL_TraceSpan * span)
+{
+    if (span->start) {
+        SDL_TraceRecord(span);
+    }
+}
+
+/* Traces the rest of the enclosing block, put it after the declarations */
+#if defined(__GNUC__)
+#define COMPAT_TRACE(name) \
+    SDL_TraceSpan trace_span __attribute__((cleanup(SDL_TraceEnd))) = \
+        { name, SDL_TraceEnabled ? SDL_GetPerformanceCounter() : 0 }
+#else
+#define COMPAT_TRACE(name)
+#endif
+
+/* === Metrics === */
+
+/* Live counters in a shared memory page that tools/sdl-top can watch while
+ *  the game runs.  Only with SDL_COMPAT_METRICS=1.
+ */
+static SDL_CompatMetrics *SDL_Metrics = NULL;
+static char SDL_MetricsName[32];
+static Uint64 SDL_LastPresent = 0;
+static Uint64 SDL_LoadCounter = 0;         /* When the library was loaded */
+
+#if defined(__GNUC__)
+#define COMPAT_METRIC_ADD(field, value) \
+    do { \
+        if (SDL_Metrics) \
+            __atomic_fetch_add(&SDL_Metrics->field, (value), __ATOMIC_RELAXED); \
+    } while (0)
+#else
+#define COMPAT_METRIC_ADD(field, value) \
+    do { if (SDL_Metrics) SDL_Metrics->field += (value); } while (0)
+#endif
+
+/* For values that are replaced rather than summed */
+#define COMPAT_METRIC_SET(field, value) \
+    do { if (SDL_Metrics) SDL_Metrics->field = (value); } while (0)
+
+static int
+GetMetricsBucket(Uint64 us)
+{
+    int bucket = 0;
+
+    while (us > 1 && bucket < COMPAT_METRICS_BUCKETS - 1) {
+        us >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+/* One update went to the screen, started at the given counter value */
+static void
+SDL_CountPresent(Uint64 start, int numrects)
+{
+    Uint64 now, frequency;
+
+    if (!SDL_Metrics) {
+        return;
+    }
+    now = SDL_GetPerformanceCounter();
+    frequency = SDL_GetPerformanceFrequency();
+
+    COMPAT_METRIC_ADD(frames, 1);
+    COMPAT_METRIC_ADD(rects, numrects);
+    COMPAT_METRIC_ADD(present_us, (now - start) * 1000000 / frequency);
+    COMPAT_METRIC_ADD(present_hist[GetMetricsBucket((now - start) * 1000000 /
+                                                    frequency)], 1);
+    if (SDL_LastPresent) {
+        COMPAT_METRIC_ADD(interval_hist[GetMetricsBucket((now - SDL_LastPresent) *
+                                                         1000000 / frequency)], 1);
+    }
+    SDL_LastPresent = now;
+}
+
+/* The application finished a frame, with SDL_Flip or SDL_GL_SwapBuffers */
+static void
+SDL_CountFlip(void)
+{
+    Uint64 us;
+
+    COMPAT_METRIC_ADD(flips, 1);
+    if (!SDL_Metrics || SDL_Metrics->first_frame_us) {
+        return;
+    }
+    us = (SDL_GetPerformanceCounter() - SDL_LoadCounter) * 1000000 /
+        SDL_GetPerformanceFrequency();
+    SDL_Metrics->first_frame_us = SDL_max(us, 1);
+}
+
+/* Pages left behind by processes that crashed or _exit()ed */
+static void
+SDL_RemoveStaleMetrics(void)
+{
+    DIR *dir = opendir("/dev/shm");
+    struct dirent *entry;
+    char name[sizeof(SDL_MetricsName)];
+    int pid;
+
+    if (!dir) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, COMPAT_METRICS_NAME + 1, &pid) == 1 &&
+            kill(pid, 0) < 0 && errno == ESRCH) {
+            SDL_snprintf(name, sizeof(name), COMPAT_METRICS_NAME, pid);
+            shm_unlink(name);
+        }
+    }
+    closedir(dir);
+}
+
+static void
+SDL_InitMetrics(void)
+{
+    const char *env = SDL_getenv("SDL_COMPAT_METRICS");
+    void *page;
+    int fd;
+
+    if (!env || !SDL_atoi(env)) {
+        return;
+    }
+    SDL_RemoveStaleMetrics();
+
+    SDL_snprintf(SDL_MetricsName, sizeof(SDL_MetricsName),
+                 COMPAT_METRICS_NAME, (int) getpid());
+    fd = shm_open(SDL_MetricsName, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    if (ftruncate(fd, sizeof(SDL_CompatMetrics)) < 0) {
+        close(fd);
+        shm_unlink(SDL_MetricsName);
+        return;
+    }
+    page = mmap(NULL, sizeof(SDL_CompatMetrics), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        shm_unlink(SDL_MetricsName);
+        return;
+    }
+
+    SDL_Metrics = (SDL_CompatMetrics *) page;
+    SDL_Metrics->pid = (int32_t) getpid();
+    SDL_Metrics->size = sizeof(SDL_CompatMetrics);
+    SDL_Metrics->version = COMPAT_METRICS_VERSION;
+    __atomic_store_n(&SDL_Metrics->magic, COMPAT_METRICS_MAGIC, __ATOMIC_RELEASE);
+}
+
+static void
+SDL_QuitMetrics(void)
+{
+    if (SDL_Metrics) {
+        /* A forked child exiting mustn't take its parent's page with it */
+        if (SDL_Metrics->pid == (int32_t) getpid()) {
+            shm_unlink(SDL_MetricsName);
+        }
+        munmap(SDL_Metrics, sizeof(SDL_CompatMetrics));
+        SDL_Metrics = NULL;
+    }
+}
+
+static void
+SDL_TraceSignal(int sig)
+{
+    SDL_TraceDumpRequested = 1;
+}
+
+static void
+SDL_InitTrace(void)
+{
+    const char *env = SDL_getenv("SDL_COMPAT_TRACE");
+    struct sigaction action, previous;
+
+    if (!env || !*env) {
+        return;
+    }
+    SDL_TracePath = SDL_strdup(env);
+    if (!SDL_TracePath) {
+        return;
+    }
+    SDL_TraceEnabled = SDL_TRUE;
+
+    /* Leave SIGUSR2 alone if the application wants it */
+    if (sigaction(SIGUSR2, NULL, &previous) == 0 &&
+        previous.sa_handler == SIG_DFL) {
+        SDL_zero(action);
+        action.sa_handler = SDL_TraceSignal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR2, &action, NULL);
+    }
+}
 
 
 /* There are few API changes between 2.0 and 1.3, the main one is the removal
@@ -135,6 +512,18 @@ typedef struct
     Uint8 r, g, b, a;
 } SDL_BlitInfo;
 
+/* SDL_BlitInfo flags, from SDL_blit.h */
+#define SDL_COPY_MODULATE_COLOR     0x00000001
+#define SDL_COPY_MODULATE_ALPHA     0x00000002
+#define SDL_COPY_BLEND              0x00000010
+#define SDL_COPY_ADD                0x00000020
+#define SDL_COPY_MOD                0x00000040
+#define SDL_COPY_MUL                0x00000080
+#define SDL_COPY_COLORKEY           0x00000100
+#define SDL_COPY_MODIFIERS  (SDL_COPY_MODULATE_COLOR | SDL_COPY_MODULATE_ALPHA | \
+                             SDL_COPY_BLEND | SDL_COPY_ADD | SDL_COPY_MOD | \
+                             SDL_COPY_MUL | SDL_COPY_COLORKEY)
+
 typedef void (SDLCALL * SDL_BlitFunc) (SDL_BlitInfo * info);
 
 typedef struct
@@ -212,71 +601,382 @@ SDL_VideoDriverName(char *namebuf, int maxlen)
     return NULL;
 }
 
+/* === Configuration === */
+
+/* How SDL_COMPAT_SCALE fits the screen to a fullscreen window */
+enum
+{
+    COMPAT_SCALE_NONE,          /* Centred as it is */
+    COMPAT_SCALE_NEAREST,
+    COMPAT_SCALE_INTEGER,       /* Nearest, by whole multiples */
+    COMPAT_SCALE_LINEAR
+};
+
+/* Every environment variable the compatibility layer reads after loading,
+ *  parsed in one go.  Setting one with SDL_setenv() or SDL_putenv() has it
+ *  parsed again next time it's needed, as does SDL_SetVideoMode(), because
+ *  SDL 1.2 applications often set SDL_VIDEO_* with putenv() first.
+ */
+typedef struct
+{
+    int display;                /* SDL_VIDEO_FULLSCREEN_DISPLAY/HEAD */
+    SDL_bool window_pos;        /* SDL_VIDEO_WINDOW_POS=x,y */
+    int window_x, window_y;
+    SDL_bool centered;          /* SDL_VIDEO_CENTERED, SDL_VIDEO_WINDOW_POS=center */
+    int allow_screensaver;      /* SDL_VIDEO_ALLOW_SCREENSAVER, -1 if unset */
+    SDL_bool yuv_hwaccel;       /* SDL_VIDEO_YUV_HWACCEL */
+    int update_coverage;        /* SDL_COMPAT_UPDATE_COVERAGE */
+    Uint32 deferred_present;    /* SDL_COMPAT_DEFERRED_PRESENT */
+    int convert_threads;        /* SDL_COMPAT_CONVERT_THREADS, -1 if unset */
+    char *renderer;             /* SDL_COMPAT_RENDERER, NULL for none */
+    SDL_bool async_present;     /* SDL_COMPAT_ASYNC_PRESENT */
+    SDL_bool coalesce_motion;   /* SDL_COMPAT_COALESCE_MOTION */
+    float wheel_threshold;      /* SDL_COMPAT_WHEEL_THRESHOLD */
+    SDL_bool probe_displays;    /* SDL_COMPAT_PROBE_DISPLAYS */
+    int scale;                  /* SDL_COMPAT_SCALE, COMPAT_SCALE_* */
+} SDL_CompatConfig;
+
+static SDL_CompatConfig SDL_Config;
+static SDL_bool SDL_ConfigStale = SDL_TRUE;
+
+static SDL_bool
+GetConfigFlag(const char *name)
+{
+    const char *env = SDL_getenv(name);
+
+    return (env && SDL_atoi(env)) ? SDL_TRUE : SDL_FALSE;
+}
+
+static void
+LoadConfig(void)
+{
+    const char *env;
+
+    env = SDL_getenv("SDL_VIDEO_FULLSCREEN_DISPLAY");
+    if (!env) {
+        env = SDL_getenv("SDL_VIDEO_FULLSCREEN_HEAD");
+    }
+    SDL_Config.display = env ? SDL_atoi(env) : 0;
+
+    SDL_Config.centered = SDL_getenv("SDL_VIDEO_CENTERED") ? SDL_TRUE : SDL_FALSE;
+    SDL_Config.window_pos = SDL_FALSE;
+    env = SDL_getenv("SDL_VIDEO_WINDOW_POS");
+    if (env) {
+        if (SDL_sscanf(env, "%d,%d", &SDL_Config.window_x,
+                       &SDL_Config.window_y) == 2) {
+            SDL_Config.window_pos = SDL_TRUE;
+        } else if (SDL_strcmp(env, "center") == 0) {
+            SDL_Config.centered = SDL_TRUE;
+        }
+    }
+
+    env = SDL_getenv("SDL_VIDEO_ALLOW_SCREENSAVER");
+    SDL_Config.allow_screensaver = env ? !!SDL_atoi(env) : -1;
+
+    env = SDL_getenv("SDL_VIDEO_YUV_HWACCEL");
+    SDL_Config.yuv_hwaccel = (!env || SDL_atoi(env) > 0) ? SDL_TRUE : SDL_FALSE;
+
+    env = SDL_getenv("SDL_COMPAT_UPDATE_COVERAGE");
+    SDL_Config.update_coverage = env ? SDL_atoi(env) : 75;
+
+    env = SDL_getenv("SDL_COMPAT_DEFERRED_PRESENT");
+    SDL_Config.deferred_present = env ? SDL_atoi(env) : 0;
+
+    env = SDL_getenv("SDL_COMPAT_CONVERT_THREADS");
+    SDL_Config.convert_threads = env ? SDL_atoi(env) : -1;
+
+    SDL_free(SDL_Config.renderer);
+    SDL_Config.renderer = NULL;
+    env = SDL_getenv("SDL_COMPAT_RENDERER");
+    if (env && *env && SDL_strcmp(env, "0") != 0) {
+        SDL_Config.renderer = SDL_strdup(env);
+    }
+
+    SDL_Config.async_present = GetConfigFlag("SDL_COMPAT_ASYNC_PRESENT");
+    SDL_Config.coalesce_motion = GetConfigFlag("SDL_COMPAT_COALESCE_MOTION");
+
+    env = SDL_getenv("SDL_COMPAT_WHEEL_THRESHOLD");
+    if (env && SDL_atof(env) > 0.0) {
+        SDL_Config.wheel_threshold = (float) SDL_atof(env);
+    } else {
+        SDL_Config.wheel_threshold = 1.0f;
+    }
+
+    SDL_Config.probe_displays = GetConfigFlag("SDL_COMPAT_PROBE_DISPLAYS");
+
+    SDL_Config.scale = COMPAT_SCALE_NONE;
+    env = SDL_getenv("SDL_COMPAT_SCALE");
+    if (env) {
+        if (SDL_strcasecmp(env, "nearest") == 0) {
+            SDL_Config.scale = COMPAT_SCALE_NEAREST;
+        } else if (SDL_strcasecmp(env, "integer") == 0) {
+            SDL_Config.scale = COMPAT_SCALE_INTEGER;
+        } else if (SDL_strcasecmp(env, "linear") == 0 || SDL_atoi(env)) {
+            SDL_Config.scale = COMPAT_SCALE_LINEAR;
+        }
+    }
+
+    SDL_ConfigStale = SDL_FALSE;
+}
+
+static const SDL_CompatConfig *
+GetConfig(void)
+{
+    if (SDL_ConfigStale) {
+        LoadConfig();
+    }
+    return &SDL_Config;
+}
+
 static int
 GetVideoDisplay()
 {
-    const char *variable = SDL_getenv("SDL_VIDEO_FULLSCREEN_DISPLAY");
-    if ( !variable ) {
-        variable = SDL_getenv("SDL_VIDEO_FULLSCREEN_HEAD");
+    return GetConfig()->display;
+}
+
+/* The display's modes, read once and kept as SDL 1.2 style mode lists in a
+ *  single allocation.  There are two sets of lists, one per depth as
+ *  SDL_ListModes() matches it, and one per SDL_BITSPERPIXEL() for
+ *  SDL_VideoModeOK(), each largest first without duplicates.  A 0x0 entry
+ *  means any size.
+ */
+#define COMPAT_MAX_BPP  32
+
+static struct
+{
+    SDL_bool valid;
+    int display;
+    SDL_DisplayMode desktop;
+    SDL_bool any_size;          /* Some mode has no size */
+    SDL_Rect **depths[COMPAT_MAX_BPP + 1];
+    SDL_Rect **bits[COMPAT_MAX_BPP + 1];        /* bits[0], format unknown */
+    void *memory;
+    SDL_VideoInfo info;
+} SDL_ModeCache;
+
+/* SDL_COMPAT_PROBE_DISPLAYS=1 builds the cache on a thread of its own as
+ *  soon as the video subsystem is up, while the application gets on with
+ *  loading.  Anything that needs the cache or the display waits for it.
+ */
+static SDL_Thread *SDL_ProbeThread = NULL;
+
+static void
+WaitForDisplayProbe(void)
+{
+    if (SDL_ProbeThread) {
+        SDL_WaitThread(SDL_ProbeThread, NULL);
+        SDL_ProbeThread = NULL;
     }
-    if ( variable ) {
-        return SDL_atoi(variable);
-    } else {
-        return 0;
+}
+
+static void
+InvalidateModeCache(void)
+{
+    WaitForDisplayProbe();
+    SDL_ModeCache.valid = SDL_FALSE;
+}
+
+static int
+CompareModeRects(const void *a, const void *b)
+{
+    const SDL_Rect *A = (const SDL_Rect *) a;
+    const SDL_Rect *B = (const SDL_Rect *) b;
+
+    if (A->w != B->w) {
+        return B->w - A->w;
     }
+    return B->h - A->h;
 }
 
-const SDL_VideoInfo *
-SDL_GetVideoInfo(void)
+/* Sort the modes with each key into a list, taking rects and pointers */
+static void
+FillModeLists(SDL_Rect ** lists[], const SDL_DisplayMode * modes,
+              const Uint8 * keys, int nmodes,
+              SDL_Rect *** pointers, SDL_Rect ** rects)
+{
+    SDL_Rect *first;
+    int key, i, count;
+
+    for (key = 0; key <= COMPAT_MAX_BPP; ++key) {
+        first = *rects;
+        count = 0;
+        for (i = 0; i < nmodes; ++i) {
+            if (keys[i] == key) {
+                first[count].x = 0;
+                first[count].y = 0;
+                first[count].w = modes[i].w;
+                first[count].h = modes[i].h;
+                ++count;
+            }
+        }
+        if (!count) {
+            lists[key] = NULL;
+            continue;
+        }
+
+        SDL_qsort(first, count, sizeof(*first), CompareModeRects);
+        lists[key] = *pointers;
+        for (i = 0; i < count; ++i) {
+            if (i > 0 && CompareModeRects(&first[i], *rects - 1) == 0) {
+                continue;
+            }
+            **rects = first[i];
+            *(*pointers)++ = (*rects)++;
+        }
+        *(*pointers)++ = NULL;
+    }
+}
+
+static SDL_bool
+BuildModeCache(int display)
+{
+    SDL_DisplayMode *modes;
+    Uint8 *depths, *bits;
+    SDL_Rect **pointers;
+    SDL_Rect *rects;
+    int i, nmodes;
+
+    if (SDL_GetDesktopDisplayMode(display, &SDL_ModeCache.desktop) < 0) {
+        return SDL_FALSE;
+    }
+    nmodes = SDL_max(SDL_GetNumDisplayModes(display), 0);
+
+    modes = (SDL_DisplayMode *) SDL_malloc(nmodes * (sizeof(*modes) + 2) + 1);
+    SDL_free(SDL_ModeCache.memory);
+    SDL_ModeCache.memory =
+        SDL_malloc(2 * (nmodes + COMPAT_MAX_BPP + 1) * sizeof(*pointers) +
+                   2 * nmodes * sizeof(*rects));
+    if (!modes || !SDL_ModeCache.memory) {
+        SDL_free(modes);
+        SDL_free(SDL_ModeCache.memory);
+        SDL_ModeCache.memory = NULL;
+        SDL_OutOfMemory();
+        return SDL_FALSE;
+    }
+    depths = (Uint8 *) &modes[nmodes];
+    bits = depths + nmodes;
+
+    SDL_ModeCache.any_size = SDL_FALSE;
+    for (i = 0; i < nmodes; ++i) {
+        SDL_GetDisplayMode(display, i, &modes[i]);
+        if (!modes[i].w || !modes[i].h) {
+            modes[i].w = modes[i].h = 0;
+            SDL_ModeCache.any_size = SDL_TRUE;
+        }
+
+        /* Copied from src/video/SDL_pixels.c:SDL_PixelFormatEnumToMasks */
+        bits[i] = (Uint8) SDL_min(SDL_BITSPERPIXEL(modes[i].format),
+                                  COMPAT_MAX_BPP);
+        if (SDL_BYTESPERPIXEL(modes[i].format) <= 2) {
+            depths[i] = bits[i];
+        } else {
+            depths[i] = (Uint8) SDL_min(SDL_BYTESPERPIXEL(modes[i].format) * 8,
+                                        COMPAT_MAX_BPP);
+        }
+    }
+
+    pointers = (SDL_Rect **) SDL_ModeCache.memory;
+    rects = (SDL_Rect *) (pointers + 2 * (nmodes + COMPAT_MAX_BPP + 1));
+    FillModeLists(SDL_ModeCache.depths, modes, depths, nmodes,
+                  &pointers, &rects);
+    FillModeLists(SDL_ModeCache.bits, modes, bits, nmodes,
+                  &pointers, &rects);
+    SDL_free(modes);
+
+    /* The old format stays allocated, applications may hold on to it */
+    if (!SDL_ModeCache.info.vfmt ||
+        SDL_ModeCache.info.vfmt->format != SDL_ModeCache.desktop.format) {
+        SDL_ModeCache.info.vfmt = SDL_AllocFormat(SDL_ModeCache.desktop.format);
+    }
+    SDL_ModeCache.info.current_w = SDL_ModeCache.desktop.w;
+    SDL_ModeCache.info.current_h = SDL_ModeCache.desktop.h;
+
+    SDL_ModeCache.display = display;
+    SDL_ModeCache.valid = SDL_TRUE;
+    return SDL_TRUE;
+}
+
+static int SDLCALL
+SDL_DisplayProbeThread(void *data)
+{
+    COMPAT_TRACE("SDL_DisplayProbeThread");
+
+    BuildModeCache((int) (intptr_t) data);
+    return 0;
+}
+
+static void
+StartDisplayProbe(void)
+{
+    if (!GetConfig()->probe_displays || SDL_ProbeThread ||
+        SDL_ModeCache.valid) {
+        return;
+    }
+    SDL_ProbeThread = SDL_CreateThread(SDL_DisplayProbeThread,
+                                       "SDL_compat probe",
+                                       (void *) (intptr_t) GetVideoDisplay());
+}
+
+static SDL_bool
+GetModeCache(void)
 {
-    static SDL_VideoInfo info;
-    SDL_DisplayMode mode;
+    int display = GetVideoDisplay();
 
-    /* Memory leak, compatibility code, who cares? */
-    if (!info.vfmt && SDL_GetDesktopDisplayMode(GetVideoDisplay(), &mode) == 0) {
-        info.vfmt = SDL_AllocFormat(mode.format);
-        info.current_w = mode.w;
-        info.current_h = mode.h;
+    WaitForDisplayProbe();
+    if (SDL_ModeCache.valid && SDL_ModeCache.display == display) {
+        return SDL_TRUE;
     }
-    return &info;
+    return BuildModeCache(display);
+}
+
+static SDL_bool
+HasModeSize(SDL_Rect ** list, int width, int height)
+{
+    if (!list) {
+        return SDL_FALSE;
+    }
+    for (; *list; ++list) {
+        if (!(*list)->w || ((*list)->w == width && (*list)->h == height)) {
+            return SDL_TRUE;
+        }
+    }
+    return SDL_FALSE;
+}
+
+const SDL_VideoInfo *
+SDL_GetVideoInfo(void)
+{
+    GetModeCache();
+    return &SDL_ModeCache.info;
 }
 
 int
 SDL_VideoModeOK(int width, int height, int bpp, Uint32 flags)
 {
-    int i, actual_bpp = 0;
+    int actual_bpp;
 
-    if (!SDL_WasInit(SDL_INIT_VIDEO)) {
+    if (!SDL_WasInit(SDL_INIT_VIDEO) || !GetModeCache()) {
         return 0;
     }
 
     if (!(flags & SDL_FULLSCREEN)) {
-        SDL_DisplayMode mode;
-        SDL_GetDesktopDisplayMode(GetVideoDisplay(), &mode);
-        return SDL_BITSPERPIXEL(mode.format);
+        return SDL_BITSPERPIXEL(SDL_ModeCache.desktop.format);
     }
 
-    for (i = 0; i < SDL_GetNumDisplayModes(GetVideoDisplay()); ++i) {
-        SDL_DisplayMode mode;
-        SDL_GetDisplayMode(GetVideoDisplay(), i, &mode);
-        if (!mode.w || !mode.h || (width == mode.w && height == mode.h)) {
-            if (!mode.format) {
-                return bpp;
-            }
-            if (SDL_BITSPERPIXEL(mode.format) >= (Uint32) bpp) {
-                actual_bpp = SDL_BITSPERPIXEL(mode.format);
-            }
+    if (HasModeSize(SDL_ModeCache.bits[0], width, height)) {
+        return bpp;
+    }
+    for (actual_bpp = SDL_max(bpp, 1); actual_bpp <= COMPAT_MAX_BPP; ++actual_bpp) {
+        if (HasModeSize(SDL_ModeCache.bits[actual_bpp], width, height)) {
+            return actual_bpp;
         }
     }
-    return actual_bpp;
+    return 0;
 }
 
 SDL_Rect **
 SDL_ListModes(const SDL_PixelFormat * format, Uint32 flags)
 {
-    int i, nmodes;
-    SDL_Rect **modes;
-
     if (!SDL_WasInit(SDL_INIT_VIDEO)) {
         return NULL;
     }
@@ -285,55 +985,19 @@ SDL_ListModes(const SDL_PixelFormat * format, Uint32 flags)
         return (SDL_Rect **) (-1);
     }
 
-    if (!format) {
-        format = SDL_GetVideoInfo()->vfmt;
+    if (!GetModeCache()) {
+        return NULL;
     }
-
-    /* Memory leak, but this is a compatibility function, who cares? */
-    nmodes = 0;
-    modes = NULL;
-    for (i = 0; i < SDL_GetNumDisplayModes(GetVideoDisplay()); ++i) {
-        SDL_DisplayMode mode;
-        int bpp;
-
-        SDL_GetDisplayMode(GetVideoDisplay(), i, &mode);
-        if (!mode.w || !mode.h) {
-            return (SDL_Rect **) (-1);
-        }
-        
-        /* Copied from src/video/SDL_pixels.c:SDL_PixelFormatEnumToMasks */
-        if (SDL_BYTESPERPIXEL(mode.format) <= 2) {
-            bpp = SDL_BITSPERPIXEL(mode.format);
-        } else {
-            bpp = SDL_BYTESPERPIXEL(mode.format) * 8;
-        }
-
-        if (bpp != format->BitsPerPixel) {
-            continue;
-        }
-        if (nmodes > 0 && modes[nmodes - 1]->w == mode.w
-            && modes[nmodes - 1]->h == mode.h) {
-            continue;
-        }
-
-        modes = SDL_realloc(modes, (nmodes + 2) * sizeof(*modes));
-        if (!modes) {
-            return NULL;
-        }
-        modes[nmodes] = (SDL_Rect *) SDL_malloc(sizeof(SDL_Rect));
-        if (!modes[nmodes]) {
-            return NULL;
-        }
-        modes[nmodes]->x = 0;
-        modes[nmodes]->y = 0;
-        modes[nmodes]->w = mode.w;
-        modes[nmodes]->h = mode.h;
-        ++nmodes;
+    if (SDL_ModeCache.any_size) {
+        return (SDL_Rect **) (-1);
+    }
+    if (!format) {
+        format = SDL_ModeCache.info.vfmt;
     }
-    if (modes) {
-        modes[nmodes] = NULL;
+    if (!format || format->BitsPerPixel > COMPAT_MAX_BPP) {
+        return NULL;
     }
-    return modes;
+    return SDL_ModeCache.depths[format->BitsPerPixel];
 }
 
 /* === Event handling === */
@@ -392,22 +1056,434 @@ typedef union SDL_Event_Compat
     SDL_ResizeEvent resize;
 } SDL_Event_Compat;
 
+/* SDL 2.0 entry points the compatibility layer wraps.  Applications
+ *  linked against this library resolve these names here first, and we
+ *  pass them on to SDL 2.0's own implementation.
+ */
+static void (SDLCALL * SDL2_PumpEvents) (void);
+static int (SDLCALL * SDL2_WaitEventTimeout) (SDL_Event * event, int timeout);
+static int (SDLCALL * SDL2_PeepEvents) (SDL_Event * events, int numevents,
+                                        SDL_eventaction action,
+                                        Uint32 minType, Uint32 maxType);
+static SDL_bool (SDLCALL * SDL2_HasEvents) (Uint32 minType, Uint32 maxType);
+static void (SDLCALL * SDL2_FlushEvents) (Uint32 minType, Uint32 maxType);
+static Uint8 (SDLCALL * SDL2_EventState) (Uint32 type, int state);
+
+static int (SDLCALL * SDL2_Init) (Uint32 flags);
+static int (SDLCALL * SDL2_InitSubSystem) (Uint32 flags);
+static void (SDLCALL * SDL2_QuitSubSystem) (Uint32 flags);
+static void (SDLCALL * SDL2_Quit) (void);
+
+static int (SDLCALL * SDL2_setenv) (const char *name, const char *value,
+                                    int overwrite);
+
+/* The event wrappers take SDL's events off its queue in batches and
+ *  translate them into a ring of our own, along with the SDL 1.2 events
+ *  made up from them, which go in front of the event they came from.
+ *  Doing it there, rather than in an event filter, keeps the work off the
+ *  thread that pushed the event and out from under SDL's queue lock, and
+ *  works whatever the application does with SDL_SetEventFilter.
+ */
+#define COMPAT_EVENT_RING_SIZE  256     /* A power of 2 */
+#define COMPAT_EVENT_BATCH      64      /* Taken off SDL's queue at once */
+#define COMPAT_EVENT_SPARE      16      /* Room kept for made up events */
+
+/* Wheel clicks made up from one wheel event, each a press and a release,
+   leaving a slot for the wheel event itself */
+#define COMPAT_WHEEL_CLICKS     ((COMPAT_EVENT_SPARE - 1) / 2)
+
+/* Made up events of which only the latest matters.  There's at most one of
+ *  each kind in the ring, and newer ones just replace its data, which is
+ *  filled in when it's read: the size, width << 16 | height, of a resize
+ *  and the gain of an active event.
+ */
+enum
+{
+    COMPAT_LATEST_EXPOSE,
+    COMPAT_LATEST_RESIZE,
+    COMPAT_LATEST_MOUSEFOCUS,
+    COMPAT_LATEST_INPUTFOCUS,
+    COMPAT_LATEST_ACTIVE,
+    COMPAT_LATEST_EVENTS
+};
+
+static struct
+{
+    SDL_Event_Compat events[COMPAT_EVENT_RING_SIZE];
+    Sint8 kind[COMPAT_EVENT_RING_SIZE]; /* COMPAT_LATEST_* or -1 */
+    SDL_atomic_t head;          /* Advanced by translation */
+    SDL_atomic_t tail;          /* Advanced as the application reads */
+    SDL_SpinLock producer;
+    SDL_atomic_t pending;       /* Bitmask of COMPAT_LATEST_* in the ring */
+    SDL_atomic_t latest[COMPAT_LATEST_EVENTS];  /* Their data, see above */
+} SDL_CompatEvents;
+
+/* Holes are left where events were picked out of the middle */
+#define COMPAT_EVENT_HOLE   SDL_FIRSTEVENT
+
+static Uint32
+GetCompatEventType(int slot)
+{
+    return __atomic_load_n(&SDL_CompatEvents.events[slot].type,
+                           __ATOMIC_RELAXED);
+}
+
+static int
+GetCompatEventSpace(void)
+{
+    Uint32 head = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.head);
+    Uint32 tail = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.tail);
+
+    return COMPAT_EVENT_RING_SIZE - (int) (head - tail);
+}
+
+/* Which COMPAT_LATEST_* a made up event is, or -1 */
+static int
+GetLatestCompatEvent(const SDL_Event_Compat * event)
+{
+    switch (event->type) {
+    case SDL_VIDEOEXPOSE:
+        return COMPAT_LATEST_EXPOSE;
+    case SDL_VIDEORESIZE:
+        return COMPAT_LATEST_RESIZE;
+    case SDL_ACTIVEEVENT:
+        switch (event->active.state) {
+        case SDL_APPMOUSEFOCUS:
+            return COMPAT_LATEST_MOUSEFOCUS;
+        case SDL_APPINPUTFOCUS:
+            return COMPAT_LATEST_INPUTFOCUS;
+        case SDL_APPACTIVE:
+            return COMPAT_LATEST_ACTIVE;
+        }
+        break;
+    }
+    return -1;
+}
+
+static void
+ClearLatestCompatEvent(int latest)
+{
+    __atomic_fetch_and(&SDL_CompatEvents.pending.value, ~(1 << latest),
+                       __ATOMIC_SEQ_CST);
+}
+
+/* Copy an event out of the ring, filling in the latest data */
+static void
+ReadCompatEvent(int slot, SDL_Event * event, SDL_bool remove)
+{
+    int latest = SDL_CompatEvents.kind[slot];
+    int data;
+
+    /* Anything newer than this either shows up below or queues another */
+    if (remove && latest >= 0) {
+        ClearLatestCompatEvent(latest);
+    }
+    if (event) {
+        SDL_memcpy(event, &SDL_CompatEvents.events[slot], sizeof(*event));
+        if (latest >= 0) {
+            data = SDL_AtomicGet(&SDL_CompatEvents.latest[latest]);
+            if (event->type == SDL_VIDEORESIZE) {
+                ((SDL_Event_Compat *) event)->resize.w = (data >> 16) & 0xFFFF;
+                ((SDL_Event_Compat *) event)->resize.h = data & 0xFFFF;
+            } else if (event->type == SDL_ACTIVEEVENT) {
+                ((SDL_Event_Compat *) event)->active.gain = (Uint8) data;
+            }
+        }
+    }
+    if (remove) {
+        __atomic_store_n(&SDL_CompatEvents.events[slot].type,
+                         COMPAT_EVENT_HOLE, __ATOMIC_RELAXED);
+    }
+}
+
+/* Step the tail over anything already taken */
+static void
+SkipCompatEventHoles(void)
+{
+    Uint32 head = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.head);
+    Uint32 tail = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.tail);
+
+    while (tail != head &&
+           GetCompatEventType(tail % COMPAT_EVENT_RING_SIZE) ==
+           COMPAT_EVENT_HOLE) {
+        ++tail;
+    }
+    SDL_AtomicSet(&SDL_CompatEvents.tail, (int) tail);
+}
+
+/* Take (or look at) the oldest translated event */
+static SDL_bool
+GetCompatEvent(SDL_Event * event, SDL_bool remove)
+{
+    Uint32 head, tail;
+
+    SkipCompatEventHoles();
+    head = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.head);
+    tail = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.tail);
+    if (tail == head) {
+        return SDL_FALSE;
+    }
+    ReadCompatEvent(tail % COMPAT_EVENT_RING_SIZE, event, remove);
+    if (remove) {
+        SkipCompatEventHoles();
+    }
+    return SDL_TRUE;
+}
+
+/* SDL_PeepEvents on the ring */
+static int
+PeepCompatEvents(SDL_Event * events, int numevents, SDL_eventaction action,
+                 Uint32 minType, Uint32 maxType)
+{
+    Uint32 head = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.head);
+    Uint32 tail = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.tail);
+    int used = 0;
+
+    for (; tail != head; ++tail) {
+        int slot = tail % COMPAT_EVENT_RING_SIZE;
+        Uint32 type = GetCompatEventType(slot);
+
+        if (type == COMPAT_EVENT_HOLE || type < minType || type > maxType) {
+            continue;
+        }
+        if (events) {
+            if (used == numevents) {
+                break;
+            }
+            ReadCompatEvent(slot, &events[used], action == SDL_GETEVENT);
+        }
+        ++used;
+    }
+    SkipCompatEventHoles();
+    return used;
+}
+
+/* SDL_FlushEvents on the ring */
+static void
+FlushCompatEvents(Uint32 minType, Uint32 maxType)
+{
+    Uint32 head = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.head);
+    Uint32 tail = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.tail);
+
+    for (; tail != head; ++tail) {
+        int slot = tail % COMPAT_EVENT_RING_SIZE;
+        Uint32 type = GetCompatEventType(slot);
+
+        if (type != COMPAT_EVENT_HOLE && type >= minType && type <= maxType) {
+            ReadCompatEvent(slot, NULL, SDL_TRUE);
+        }
+    }
+    SkipCompatEventHoles();
+}
+
+static void
+CountCompatEvent(const SDL_Event * event)
+{
+    switch (event->type) {
+    case SDL_WINDOWEVENT:
+        COMPAT_METRIC_ADD(events[COMPAT_EVENT_WINDOW], 1);
+        break;
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+        COMPAT_METRIC_ADD(events[COMPAT_EVENT_KEY], 1);
+        break;
+    case SDL_TEXTINPUT:
+        COMPAT_METRIC_ADD(events[COMPAT_EVENT_TEXT], 1);
+        break;
+    case SDL_MOUSEMOTION:
+        COMPAT_METRIC_ADD(events[COMPAT_EVENT_MOTION], 1);
+        break;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+        COMPAT_METRIC_ADD(events[COMPAT_EVENT_BUTTON], 1);
+        break;
+    case SDL_MOUSEWHEEL:
+        COMPAT_METRIC_ADD(events[COMPAT_EVENT_WHEEL], 1);
+        break;
+    default:
+        COMPAT_METRIC_ADD(events[COMPAT_EVENT_OTHER], 1);
+        break;
+    }
+}
+
+/* Add an event to the ring.  Translation leaves COMPAT_EVENT_SPARE slots
+   for the events made up from each one, anything past that is dropped. */
+static void
+QueueCompatEvent(const SDL_Event_Compat * event, int kind)
+{
+    Uint32 head, tail;
+    int slot;
+
+    SDL_AtomicLock(&SDL_CompatEvents.producer);
+    head = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.head);
+    tail = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.tail);
+    if (head - tail < COMPAT_EVENT_RING_SIZE) {
+        slot = head % COMPAT_EVENT_RING_SIZE;
+        SDL_CompatEvents.events[slot] = *event;
+        SDL_CompatEvents.kind[slot] = (Sint8) kind;
+        SDL_AtomicSet(&SDL_CompatEvents.head, (int) (head + 1));
+    } else if (kind >= 0) {
+        ClearLatestCompatEvent(kind);
+    }
+    SDL_AtomicUnlock(&SDL_CompatEvents.producer);
+}
+
+/* Queue an SDL 1.2 event made up during translation */
+static void
+PushCompatEvent(SDL_Event_Compat * fake)
+{
+    switch (fake->type) {
+    case SDL_VIDEOEXPOSE:
+        COMPAT_METRIC_ADD(synthesized[COMPAT_SYNTH_EXPOSE], 1);
+        break;
+    case SDL_VIDEORESIZE:
+        COMPAT_METRIC_ADD(synthesized[COMPAT_SYNTH_RESIZE], 1);
+        break;
+    case SDL_ACTIVEEVENT:
+        COMPAT_METRIC_ADD(synthesized[COMPAT_SYNTH_ACTIVE], 1);
+        break;
+    case SDL_QUIT:
+        COMPAT_METRIC_ADD(synthesized[COMPAT_SYNTH_QUIT], 1);
+        break;
+    case SDL_KEYDOWN:
+        COMPAT_METRIC_ADD(synthesized[COMPAT_SYNTH_REPEAT], 1);
+        break;
+    default:
+        COMPAT_METRIC_ADD(synthesized[COMPAT_SYNTH_BUTTON], 1);
+        break;
+    }
+    QueueCompatEvent(fake, GetLatestCompatEvent(fake));
+}
+
+/* Queue a made up COMPAT_LATEST_* event, unless one is already waiting and
+ *  can pick up data instead */
+static void
+PushLatestCompatEvent(SDL_Event_Compat * fake, int data)
+{
+    int latest = GetLatestCompatEvent(fake);
+    int bit = 1 << latest;
+
+    SDL_AtomicSet(&SDL_CompatEvents.latest[latest], data);
+    if (!(__atomic_fetch_or(&SDL_CompatEvents.pending.value, bit,
+                            __ATOMIC_SEQ_CST) & bit)) {
+        PushCompatEvent(fake);
+    }
+}
+
+/* Where the pointer was at the last mouse event, in window coordinates */
+static int SDL_LastMouseX, SDL_LastMouseY;
+static int SDL_MouseRemainderX, SDL_MouseRemainderY;
+static SDL_bool SDL_HaveLastMouse = SDL_FALSE;
+static float SDL_WheelAccumulator = 0.0f;
+
+/* Window coordinates to screen coordinates, through the viewport the
+ *  screen is centred or scaled into */
+static void
+MapMousePosition(int *x, int *y)
+{
+    *x -= SDL_VideoViewport.x;
+    *y -= SDL_VideoViewport.y;
+    if (!SDL_PublicSurface || SDL_VideoViewport.w <= 0 ||
+        SDL_VideoViewport.h <= 0) {
+        return;
+    }
+    if (SDL_VideoViewport.w != SDL_PublicSurface->w) {
+        *x = (int) ((Sint64) *x * SDL_PublicSurface->w / SDL_VideoViewport.w);
+    }
+    if (SDL_VideoViewport.h != SDL_PublicSurface->h) {
+        *y = (int) ((Sint64) *y * SDL_PublicSurface->h / SDL_VideoViewport.h);
+    }
+}
+
 static int
-SDL_CompatEventFilter(void *userdata, SDL_Event * event)
+MapMouseDistance(int distance, int screen, int viewport, int *remainder)
+{
+    int mapped;
+
+    if (viewport <= 0 || viewport == screen) {
+        return distance;
+    }
+    /* Keep what doesn't make a whole pixel yet for next time */
+    *remainder += distance * screen;
+    mapped = *remainder / viewport;
+    *remainder -= mapped * viewport;
+    return mapped;
+}
+
+static void
+MapMouseMotion(int *xrel, int *yrel)
+{
+    if (!SDL_PublicSurface) {
+        return;
+    }
+    *xrel = MapMouseDistance(*xrel, SDL_PublicSurface->w,
+                             SDL_VideoViewport.w, &SDL_MouseRemainderX);
+    *yrel = MapMouseDistance(*yrel, SDL_PublicSurface->h,
+                             SDL_VideoViewport.h, &SDL_MouseRemainderY);
+}
+
+/* SDL 1.2 key repeat, off until SDL_EnableKeyRepeat() turns it on.  SDL's
+ *  own repeats are dropped by translation and the key held down last is
+ *  repeated from the event wrappers instead, at the rate asked for.
+ */
+static struct
+{
+    SDL_SpinLock lock;
+    int delay;
+    int interval;
+    SDL_bool held;
+    Uint32 next;                /* When it repeats next, in ticks */
+    SDL_KeyboardEvent key;
+} SDL_KeyRepeat;
+
+static void
+TrackKeyRepeat(const SDL_KeyboardEvent * key)
+{
+    SDL_AtomicLock(&SDL_KeyRepeat.lock);
+    if (key->type == SDL_KEYDOWN) {
+        if (SDL_KeyRepeat.delay) {
+            SDL_KeyRepeat.key = *key;
+            SDL_KeyRepeat.held = SDL_TRUE;
+            SDL_KeyRepeat.next = key->timestamp + SDL_KeyRepeat.delay;
+        }
+    } else if (key->keysym.scancode == SDL_KeyRepeat.key.keysym.scancode) {
+        SDL_KeyRepeat.held = SDL_FALSE;
+    }
+    SDL_AtomicUnlock(&SDL_KeyRepeat.lock);
+}
+
+static void
+ResetKeyRepeat(void)
+{
+    SDL_AtomicLock(&SDL_KeyRepeat.lock);
+    SDL_KeyRepeat.held = SDL_FALSE;
+    SDL_AtomicUnlock(&SDL_KeyRepeat.lock);
+}
+
+/* Turn an SDL 2.0 event into its SDL 1.3 form in place, queueing any SDL 1.2
+   events made from it.  Returns SDL_FALSE if it should be dropped. */
+static SDL_bool
+TranslateEvent(SDL_Event * event)
 {
     SDL_Event_Compat fake;
 
+    if (SDL_Metrics) {
+        CountCompatEvent(event);
+    }
+
     switch (event->type) {
+#if SDL_VERSION_ATLEAST(2, 0, 9)
+    case SDL_DISPLAYEVENT:
+        InvalidateModeCache();
+        break;
+#endif
     case SDL_WINDOWEVENT:
         switch (event->window.event) {
         case SDL_WINDOWEVENT_EXPOSED:
-            if (!SDL_HasEvent(SDL_VIDEOEXPOSE)) {
-                fake.type = SDL_VIDEOEXPOSE;
-                SDL_PushEvent((SDL_Event *) &fake);
-            }
+            fake.type = SDL_VIDEOEXPOSE;
+            PushLatestCompatEvent(&fake, 0);
             break;
         case SDL_WINDOWEVENT_RESIZED:
-            SDL_FlushEvent(SDL_VIDEORESIZE);
             /* We don't want to expose that the window width and height will
                be different if we don't get the desired fullscreen mode.
             */
@@ -415,54 +1491,60 @@ SDL_CompatEventFilter(void *userdata, SDL_Event * event)
                 fake.type = SDL_VIDEORESIZE;
                 fake.resize.w = event->window.data1;
                 fake.resize.h = event->window.data2;
-                SDL_PushEvent((SDL_Event *) &fake);
+                PushLatestCompatEvent(&fake,
+                                      (event->window.data1 & 0xFFFF) << 16 |
+                                      (event->window.data2 & 0xFFFF));
             }
             break;
         case SDL_WINDOWEVENT_MINIMIZED:
             fake.type = SDL_ACTIVEEVENT;
             fake.active.gain = 0;
             fake.active.state = SDL_APPACTIVE;
-            SDL_PushEvent((SDL_Event *) &fake);
+            PushLatestCompatEvent(&fake, fake.active.gain);
             break;
         case SDL_WINDOWEVENT_RESTORED:
             fake.type = SDL_ACTIVEEVENT;
             fake.active.gain = 1;
             fake.active.state = SDL_APPACTIVE;
-            SDL_PushEvent((SDL_Event *) &fake);
+            PushLatestCompatEvent(&fake, fake.active.gain);
             break;
         case SDL_WINDOWEVENT_ENTER:
             fake.type = SDL_ACTIVEEVENT;
             fake.active.gain = 1;
             fake.active.state = SDL_APPMOUSEFOCUS;
-            SDL_PushEvent((SDL_Event *) &fake);
+            PushLatestCompatEvent(&fake, fake.active.gain);
             break;
         case SDL_WINDOWEVENT_LEAVE:
             fake.type = SDL_ACTIVEEVENT;
             fake.active.gain = 0;
             fake.active.state = SDL_APPMOUSEFOCUS;
-            SDL_PushEvent((SDL_Event *) &fake);
+            PushLatestCompatEvent(&fake, fake.active.gain);
             break;
         case SDL_WINDOWEVENT_FOCUS_GAINED:
             fake.type = SDL_ACTIVEEVENT;
             fake.active.gain = 1;
             fake.active.state = SDL_APPINPUTFOCUS;
-            SDL_PushEvent((SDL_Event *) &fake);
+            PushLatestCompatEvent(&fake, fake.active.gain);
             break;
         case SDL_WINDOWEVENT_FOCUS_LOST:
+            ResetKeyRepeat();
             fake.type = SDL_ACTIVEEVENT;
             fake.active.gain = 0;
             fake.active.state = SDL_APPINPUTFOCUS;
-            SDL_PushEvent((SDL_Event *) &fake);
+            PushLatestCompatEvent(&fake, fake.active.gain);
             break;
         case SDL_WINDOWEVENT_CLOSE:
             fake.type = SDL_QUIT;
-            SDL_PushEvent((SDL_Event *) &fake);
+            PushCompatEvent(&fake);
             break;
         }
     case SDL_KEYDOWN:
     case SDL_KEYUP:
         {
             Uint32 unicode = 0;
+            if (event->type == SDL_KEYDOWN && event->key.repeat) {
+                return SDL_FALSE;
+            }
             if (event->key.type == SDL_KEYDOWN && event->key.keysym.sym < 256) {
                 unicode = event->key.keysym.sym;
                 if (unicode >= 'a' && unicode <= 'z') {
@@ -477,6 +1559,9 @@ SDL_CompatEventFilter(void *userdata, SDL_Event * event)
                 /* SDL 2.0 renamed 'unicode' to 'unused'.*/
                 event->key.keysym.unused = unicode;
             }
+            if (event->type == SDL_KEYDOWN || event->type == SDL_KEYUP) {
+                TrackKeyRepeat(&event->key);
+            }
             break;
         }
     case SDL_TEXTINPUT:
@@ -487,46 +1572,85 @@ SDL_CompatEventFilter(void *userdata, SDL_Event * event)
         }
     case SDL_MOUSEMOTION:
         {
-            event->motion.x -= SDL_VideoViewport.x;
-            event->motion.y -= SDL_VideoViewport.y;
+            SDL_LastMouseX = event->motion.x;
+            SDL_LastMouseY = event->motion.y;
+            SDL_HaveLastMouse = SDL_TRUE;
+            MapMousePosition(&event->motion.x, &event->motion.y);
+            MapMouseMotion(&event->motion.xrel, &event->motion.yrel);
             break;
         }
     case SDL_MOUSEBUTTONDOWN:
     case SDL_MOUSEBUTTONUP:
         {
-            event->button.x -= SDL_VideoViewport.x;
-            event->button.y -= SDL_VideoViewport.y;
+            SDL_LastMouseX = event->button.x;
+            SDL_LastMouseY = event->button.y;
+            SDL_HaveLastMouse = SDL_TRUE;
+            MapMousePosition(&event->button.x, &event->button.y);
             break;
         }
     case SDL_MOUSEWHEEL:
         {
             Uint8 button;
-            int x, y;
-
-            if (event->wheel.y == 0) {
+            int x, y, clicks;
+            float delta;
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+            delta = event->wheel.preciseY;
+#else
+            delta = (float) event->wheel.y;
+#endif
+            if (delta == 0.0f) {
                 break;
             }
 
-            SDL_GetMouseState(&x, &y);
+            /* Smooth scrolling sends lots of small deltas, only click the
+               wheel buttons for every whole notch's worth */
+            if ((delta > 0.0f) != (SDL_WheelAccumulator > 0.0f)) {
+                SDL_WheelAccumulator = 0.0f;
+            }
+            SDL_WheelAccumulator += delta;
+
+            if (!SDL_HaveLastMouse) {
+                SDL_GetMouseState(&SDL_LastMouseX, &SDL_LastMouseY);
+                SDL_HaveLastMouse = SDL_TRUE;
+            }
 
-            if (event->wheel.y > 0) {
+            if (SDL_WheelAccumulator > 0.0f) {
                 button = SDL_BUTTON_WHEELUP;
             } else {
                 button = SDL_BUTTON_WHEELDOWN;
             }
 
+            /* These aren't translated themselves, so they need the
+               same adjustment as real button events */
             fake.button.button = button;
+            x = SDL_LastMouseX;
+            y = SDL_LastMouseY;
+            MapMousePosition(&x, &y);
             fake.button.x = x;
             fake.button.y = y;
             fake.button.windowID = event->wheel.windowID;
 
-            fake.type = SDL_MOUSEBUTTONDOWN;
-            fake.button.state = SDL_PRESSED;
-            SDL_PushEvent((SDL_Event *) &fake);
+            /* Only as many clicks as there's room for, a fast flick
+               loses the rest rather than overflowing the ring */
+            clicks = 0;
+            while (SDL_fabs(SDL_WheelAccumulator) >= SDL_WheelThreshold) {
+                if (clicks++ < COMPAT_WHEEL_CLICKS) {
+                    fake.type = SDL_MOUSEBUTTONDOWN;
+                    fake.button.state = SDL_PRESSED;
+                    PushCompatEvent(&fake);
+
+                    fake.type = SDL_MOUSEBUTTONUP;
+                    fake.button.state = SDL_RELEASED;
+                    PushCompatEvent(&fake);
+                }
 
-            fake.type = SDL_MOUSEBUTTONUP;
-            fake.button.state = SDL_RELEASED;
-            SDL_PushEvent((SDL_Event *) &fake);
+                if (SDL_WheelAccumulator > 0.0f) {
+                    SDL_WheelAccumulator -= SDL_WheelThreshold;
+                } else {
+                    SDL_WheelAccumulator += SDL_WheelThreshold;
+                }
+            }
 
             /* Convert to SDL 1.3 style event. */
             /* reuse x and y */
@@ -538,733 +1662,4293 @@ SDL_CompatEventFilter(void *userdata, SDL_Event * event)
         }
 
     }
-    return 1;
+
+    return SDL_TRUE;
 }
 
+static void SDL_FlushUpdates(void);
+static void SDL_InitWorkers(int numthreads);
+static void StopWorkers(void);
+static void SetupAsyncPresent(Uint32 flags);
+static void StopAsyncPresent(void);
+static void PauseAsyncPresent(void);
+static void StopVideoScaling(void);
+static void ResumeAsyncPresent(SDL_bool resized);
+static int SDL_AsyncFlip(SDL_Surface * screen);
+
+/* Anything held back by deferred presentation goes out before the
+   application looks for (or waits on) more input */
 static void
-GetEnvironmentWindowPosition(int w, int h, int *x, int *y)
+SDL_FlushUpdatesOnPoll(void)
 {
-    int display = GetVideoDisplay();
-    const char *window = SDL_getenv("SDL_VIDEO_WINDOW_POS");
-    const char *center = SDL_getenv("SDL_VIDEO_CENTERED");
-    if (window) {
-        if (SDL_sscanf(window, "%d,%d", x, y) == 2) {
-            return;
-        }
-        if (SDL_strcmp(window, "center") == 0) {
-            center = window;
-        }
-    }
-    if (center) {
-        *x = SDL_WINDOWPOS_CENTERED_DISPLAY(display);
-        *y = SDL_WINDOWPOS_CENTERED_DISPLAY(display);
+    if (SDL_NumPendingRects && SDL_ThreadID() == SDL_VideoThread) {
+        SDL_FlushUpdates();
     }
 }
 
+/* Pumping can touch the window, which the present thread may be
+   uploading to, so it waits its turn like SDL_PresentRects does */
 static void
-ClearVideoSurface()
+PumpSDL2Events(void)
 {
-    if (SDL_ShadowSurface) {
-        SDL_FillRect(SDL_ShadowSurface, NULL,
-            SDL_MapRGB(SDL_ShadowSurface->format, 0, 0, 0));
+    if (SDL_Flipper.thread) {
+        SDL_LockMutex(SDL_Flipper.present);
+    }
+    SDL2_PumpEvents();
+    if (SDL_Flipper.thread) {
+        SDL_UnlockMutex(SDL_Flipper.present);
     }
-    SDL_FillRect(SDL_WindowSurface, NULL, 0);
-    SDL_UpdateWindowSurface(SDL_VideoWindow);
 }
 
-static void
-SetupScreenSaver(int flags)
+/* SDL_WaitEventTimeout(NULL, ...), without holding the present lock while
+   it sleeps */
+static int
+WaitSDL2Event(int timeout)
 {
-    const char *env;
-    SDL_bool allow_screensaver;
+    Uint32 expiration = SDL_GetTicks() + timeout;
 
-    /* Allow environment override of screensaver disable */
-    env = SDL_getenv("SDL_VIDEO_ALLOW_SCREENSAVER");
-    if (env) {
-        allow_screensaver = SDL_atoi(env) ? SDL_TRUE : SDL_FALSE;
-    } else if (flags & SDL_FULLSCREEN) {
-        allow_screensaver = SDL_FALSE;
-    } else {
-        allow_screensaver = SDL_TRUE;
+    if (!SDL_Flipper.thread) {
+        return SDL2_WaitEventTimeout(NULL, timeout);
     }
-    if (allow_screensaver) {
-        SDL_EnableScreenSaver();
-    } else {
-        SDL_DisableScreenSaver();
+    for (;;) {
+        PumpSDL2Events();
+        if (SDL2_PeepEvents(NULL, 0, SDL_PEEKEVENT,
+                            SDL_FIRSTEVENT, SDL_LASTEVENT) > 0) {
+            return 1;
+        }
+        if (timeout >= 0 && (int) (expiration - SDL_GetTicks()) <= 0) {
+            return 0;
+        }
+        SDL_Delay(1);
     }
 }
 
-static int
-SDL_ResizeVideoMode(int width, int height, int bpp, Uint32 flags)
+void
+SDL_PumpEvents(void)
 {
-    int w, h;
+    COMPAT_TRACE("SDL_PumpEvents");
 
-    /* We can't resize something we don't have... */
-    if (!SDL_VideoSurface) {
-        return -1;
-    }
+    SDL_FlushUpdatesOnPoll();
+    PumpSDL2Events();
+}
 
-    /* We probably have to recreate the window in fullscreen mode */
-    if (flags & SDL_FULLSCREEN) {
-        return -1;
-    }
+/* Fold a motion event into the last one queued, if that's motion too and
+   the application hasn't read it yet */
+static SDL_bool
+CoalesceMotionEvent(const SDL_Event * event)
+{
+    Uint32 head = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.head);
+    Uint32 tail = (Uint32) SDL_AtomicGet(&SDL_CompatEvents.tail);
+    SDL_Event *last;
 
-    /* I don't think there's any change we can gracefully make in flags */
-    if (flags != SDL_VideoFlags) {
-        return -1;
+    if (head == tail) {
+        return SDL_FALSE;
     }
-    if (bpp != SDL_VideoSurface->format->BitsPerPixel) {
-        return -1;
+    last = (SDL_Event *) &SDL_CompatEvents.events[(head - 1) % COMPAT_EVENT_RING_SIZE];
+    if (last->type != SDL_MOUSEMOTION ||
+        last->motion.which != event->motion.which ||
+        last->motion.windowID != event->motion.windowID) {
+        return SDL_FALSE;
     }
+    last->motion.timestamp = event->motion.timestamp;
+    last->motion.state |= event->motion.state;
+    last->motion.x = event->motion.x;
+    last->motion.y = event->motion.y;
+    last->motion.xrel += event->motion.xrel;
+    last->motion.yrel += event->motion.yrel;
+    return SDL_TRUE;
+}
 
-    /* Resize the window */
-    SDL_GetWindowSize(SDL_VideoWindow, &w, &h);
-    if (w != width || h != height) {
-        SDL_SetWindowSize(SDL_VideoWindow, width, height);
+/* Take a batch of events off SDL's queue and translate them into the ring,
+   returning how many were taken */
+static int
+TranslateEvents(void)
+{
+    SDL_Event batch[COMPAT_EVENT_BATCH];
+    int i, count;
+    COMPAT_TRACE("TranslateEvents");
+
+    count = SDL2_PeepEvents(batch, COMPAT_EVENT_BATCH, SDL_PEEKEVENT,
+                            SDL_FIRSTEVENT, SDL_LASTEVENT);
+    for (i = 0; i < count; ++i) {
+        if (GetCompatEventSpace() <= COMPAT_EVENT_SPARE) {
+            break;
+        }
+        if (!TranslateEvent(&batch[i])) {
+            continue;
+        }
+        /* Made up events break runs of motion */
+        if (SDL_CoalesceMotion && batch[i].type == SDL_MOUSEMOTION &&
+            CoalesceMotionEvent(&batch[i])) {
+            continue;
+        }
+        QueueCompatEvent((SDL_Event_Compat *) &batch[i], -1);
     }
 
-    /* If we're in OpenGL mode, just resize the stub surface and we're done! */
-    if (flags & SDL_OPENGL) {
-        SDL_VideoSurface->w = width;
-        SDL_VideoSurface->h = height;
-        return 0;
+    /* Nothing but us takes events off the front of the queue */
+    if (i > 0) {
+        SDL2_PeepEvents(batch, i, SDL_GETEVENT,
+                        SDL_FIRSTEVENT, SDL_LASTEVENT);
     }
+    return i;
+}
 
-    SDL_WindowSurface = SDL_GetWindowSurface(SDL_VideoWindow);
-    if (!SDL_WindowSurface) {
-        return -1;
+/* Queue a repeat of the held key if it's due.  Only called once SDL's
+   queue is empty, so its release can't be waiting in there. */
+static void
+CheckKeyRepeat(void)
+{
+    SDL_Event_Compat fake;
+    SDL_bool repeat = SDL_FALSE;
+    Uint32 now, interval;
+
+    if (!SDL_KeyRepeat.held) {
+        return;
     }
-    if (SDL_VideoSurface->format != SDL_WindowSurface->format) {
-        return -1;
+
+    SDL_AtomicLock(&SDL_KeyRepeat.lock);
+    now = SDL_GetTicks();
+    if (SDL_KeyRepeat.held && (Sint32) (now - SDL_KeyRepeat.next) >= 0) {
+        fake.key = SDL_KeyRepeat.key;
+        fake.key.timestamp = now;
+        fake.key.repeat = 1;
+        repeat = SDL_TRUE;
+
+        /* Don't make up for time the application didn't look */
+        interval = SDL_max(SDL_KeyRepeat.interval, 1);
+        SDL_KeyRepeat.next += interval;
+        if ((Sint32) (now - SDL_KeyRepeat.next) >= 0) {
+            SDL_KeyRepeat.next = now + interval;
+        }
     }
-    SDL_VideoSurface->w = width;
-    SDL_VideoSurface->h = height;
-    SDL_VideoSurface->pixels = SDL_WindowSurface->pixels;
-    SDL_VideoSurface->pitch = SDL_WindowSurface->pitch;
-    SDL_SetClipRect(SDL_VideoSurface, NULL);
+    SDL_AtomicUnlock(&SDL_KeyRepeat.lock);
 
-    if (SDL_ShadowSurface) {
-        SDL_ShadowSurface->w = width;
-        SDL_ShadowSurface->h = height;
-        SDL_ShadowSurface->pitch = SDL_CalculatePitch(SDL_ShadowSurface);
-        SDL_ShadowSurface->pixels =
-            SDL_realloc(SDL_ShadowSurface->pixels,
-                        SDL_ShadowSurface->h * SDL_ShadowSurface->pitch);
-        SDL_SetClipRect(SDL_ShadowSurface, NULL);
-        SDL_InvalidateMap(SDL_ShadowSurface->map);
-    } else {
-        SDL_PublicSurface = SDL_VideoSurface;
+    if (repeat) {
+        PushCompatEvent(&fake);
     }
+}
 
-    ClearVideoSurface();
+/* Milliseconds until the held key repeats, or -1 */
+static int
+GetKeyRepeatTimeout(void)
+{
+    int timeout = -1;
 
-    return 0;
+    SDL_AtomicLock(&SDL_KeyRepeat.lock);
+    if (SDL_KeyRepeat.held) {
+        timeout = SDL_max(0, (Sint32) (SDL_KeyRepeat.next - SDL_GetTicks()));
+    }
+    SDL_AtomicUnlock(&SDL_KeyRepeat.lock);
+    return timeout;
 }
 
-SDL_Surface *
-SDL_SetVideoMode(int width, int height, int bpp, Uint32 flags)
+/* The next event for the application, translating more as needed */
+static int
+GetNextEvent(SDL_Event * event)
 {
-    SDL_DisplayMode desktop_mode;
-    int display = GetVideoDisplay();
-    int window_x = SDL_WINDOWPOS_UNDEFINED_DISPLAY(display);
-    int window_y = SDL_WINDOWPOS_UNDEFINED_DISPLAY(display);
-    int window_w;
-    int window_h;
-    Uint32 window_flags;
-    Uint32 surface_flags;
+    do {
+        if (GetCompatEvent(event, event != NULL)) {
+            return 1;
+        }
+    } while (TranslateEvents() > 0);
 
-    if (!SDL_WasInit(SDL_INIT_VIDEO)) {
-        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_NOPARACHUTE) < 0) {
-            return NULL;
+    /* SDL's queue is empty */
+    CheckKeyRepeat();
+    return GetCompatEvent(event, event != NULL);
+}
+
+int
+SDL_PollEvent(SDL_Event * event)
+{
+    COMPAT_TRACE("SDL_PollEvent");
+
+    SDL_FlushUpdatesOnPoll();
+    PumpSDL2Events();
+    return GetNextEvent(event);
+}
+
+int
+SDL_WaitEventTimeout(SDL_Event * event, int timeout)
+{
+    Uint32 expiration = SDL_GetTicks() + timeout;
+    int remaining = timeout;
+    int wait, repeat;
+    COMPAT_TRACE("SDL_WaitEventTimeout");
+
+    SDL_FlushUpdatesOnPoll();
+    for (;;) {
+        PumpSDL2Events();
+        if (GetNextEvent(event)) {
+            return 1;
+        }
+        if (timeout >= 0) {
+            remaining = (int) (expiration - SDL_GetTicks());
+            if (remaining <= 0) {
+                return 0;
+            }
+        }
+        /* Let SDL sleep until there's something, but leave it queued,
+           waking up for key repeat */
+        wait = remaining;
+        repeat = GetKeyRepeatTimeout();
+        if (repeat >= 0 && (wait < 0 || repeat < wait)) {
+            wait = repeat;
+        }
+        if (!WaitSDL2Event(wait) && wait < 0) {
+            return 0;
         }
     }
+}
 
-    SDL_GetDesktopDisplayMode(display, &desktop_mode);
+int
+SDL_WaitEvent(SDL_Event * event)
+{
+    return SDL_WaitEventTimeout(event, -1);
+}
 
-    if (width == 0) {
-        width = desktop_mode.w;
-    }
-    if (height == 0) {
-        height = desktop_mode.h;
-    }
-    if (bpp == 0) {
-        bpp = SDL_BITSPERPIXEL(desktop_mode.format);
-    }
+int
+SDL_PeepEvents(SDL_Event * events, int numevents, SDL_eventaction action,
+               Uint32 minType, Uint32 maxType)
+{
+    int used, more;
 
-    /* See if we can simply resize the existing window and surface */
-    if (SDL_ResizeVideoMode(width, height, bpp, flags) == 0) {
-        return SDL_PublicSurface;
+    if (action == SDL_ADDEVENT) {
+        return SDL2_PeepEvents(events, numevents, action, minType, maxType);
     }
 
-    /* Destroy existing window */
-    SDL_PublicSurface = NULL;
-    if (SDL_ShadowSurface) {
-        SDL_ShadowSurface->flags &= ~SDL_DONTFREE;
-        SDL_FreeSurface(SDL_ShadowSurface);
-        SDL_ShadowSurface = NULL;
+    /* Taking everything, keep them in order */
+    if (action == SDL_GETEVENT && events &&
+        minType <= SDL_FIRSTEVENT && maxType >= SDL_LASTEVENT) {
+        for (used = 0; used < numevents; ++used) {
+            if (!GetNextEvent(&events[used])) {
+                break;
+            }
+        }
+        return used;
     }
-    if (SDL_VideoSurface) {
-        SDL_VideoSurface->flags &= ~SDL_DONTFREE;
-        SDL_FreeSurface(SDL_VideoSurface);
-        SDL_VideoSurface = NULL;
+
+    /* Just looking, or only some types.  Whatever's translated comes
+       before anything left in SDL's queue. */
+    while (TranslateEvents() > 0) {
+        continue;
     }
-    if (SDL_VideoContext) {
-        /* SDL_GL_MakeCurrent(0, NULL); *//* Doesn't do anything */
-        SDL_GL_DeleteContext(SDL_VideoContext);
-        SDL_VideoContext = NULL;
+    used = PeepCompatEvents(events, numevents, action, minType, maxType);
+    if (events && used == numevents) {
+        return used;
     }
-    if (SDL_VideoWindow) {
-        SDL_GetWindowPosition(SDL_VideoWindow, &window_x, &window_y);
-        SDL_DestroyWindow(SDL_VideoWindow);
+    more = SDL2_PeepEvents(events ? &events[used] : NULL,
+                           events ? numevents - used : numevents,
+                           action, minType, maxType);
+    if (more < 0) {
+        return used ? used : more;
     }
+    return used + more;
+}
 
-    /* Set up the event filter */
-    if (!SDL_GetEventFilter(NULL, NULL)) {
-        SDL_SetEventFilter(SDL_CompatEventFilter, NULL);
+/* Translated events wait in the ring rather than SDL's queue, so these
+   have to look there too */
+SDL_bool
+SDL_HasEvents(Uint32 minType, Uint32 maxType)
+{
+    if (PeepCompatEvents(NULL, 0, SDL_PEEKEVENT, minType, maxType) > 0) {
+        return SDL_TRUE;
     }
+    return SDL2_HasEvents(minType, maxType);
+}
 
-    /* Create a new window */
-    window_flags = SDL_WINDOW_SHOWN;
-    if (flags & SDL_FULLSCREEN) {
-        window_flags |= SDL_WINDOW_FULLSCREEN;
-    }
-    if (flags & SDL_OPENGL) {
-        window_flags |= SDL_WINDOW_OPENGL;
-    }
-    if (flags & SDL_RESIZABLE) {
-        window_flags |= SDL_WINDOW_RESIZABLE;
-    }
-    if (flags & SDL_NOFRAME) {
-        window_flags |= SDL_WINDOW_BORDERLESS;
-    }
-    GetEnvironmentWindowPosition(width, height, &window_x, &window_y);
-    SDL_VideoWindow =
-        SDL_CreateWindow(wm_title, window_x, window_y, width, height,
-                         window_flags);
-    if (!SDL_VideoWindow) {
-        return NULL;
-    }
-    SDL_SetWindowIcon(SDL_VideoWindow, SDL_VideoIcon);
+SDL_bool
+SDL_HasEvent(Uint32 type)
+{
+    return SDL_HasEvents(type, type);
+}
 
-    SetupScreenSaver(flags);
+void
+SDL_FlushEvents(Uint32 minType, Uint32 maxType)
+{
+    FlushCompatEvents(minType, maxType);
+    SDL2_FlushEvents(minType, maxType);
+}
 
-    window_flags = SDL_GetWindowFlags(SDL_VideoWindow);
-    surface_flags = 0;
-    if (window_flags & SDL_WINDOW_FULLSCREEN) {
-        surface_flags |= SDL_FULLSCREEN;
-    }
-    if ((window_flags & SDL_WINDOW_OPENGL) && (flags & SDL_OPENGL)) {
-        surface_flags |= SDL_OPENGL;
+void
+SDL_FlushEvent(Uint32 type)
+{
+    SDL_FlushEvents(type, type);
+}
+
+Uint8
+SDL_EventState(Uint32 type, int state)
+{
+    if (state == SDL_IGNORE) {
+        FlushCompatEvents(type, type);
     }
-    if (window_flags & SDL_WINDOW_RESIZABLE) {
-        surface_flags |= SDL_RESIZABLE;
+    return SDL2_EventState(type, state);
+}
+
+static void
+GetEnvironmentWindowPosition(int w, int h, int *x, int *y)
+{
+    const SDL_CompatConfig *config = GetConfig();
+    int display = config->display;
+    if (config->window_pos) {
+        *x = config->window_x;
+        *y = config->window_y;
+        return;
     }
-    if (window_flags & SDL_WINDOW_BORDERLESS) {
-        surface_flags |= SDL_NOFRAME;
+    if (config->centered) {
+        *x = SDL_WINDOWPOS_CENTERED_DISPLAY(display);
+        *y = SDL_WINDOWPOS_CENTERED_DISPLAY(display);
     }
+}
 
-    SDL_VideoFlags = flags;
+/* Find the SDL_Renderer driver asked for to present software video modes,
+   -1 lets SDL pick one.  Without one we use the window surface. */
+static SDL_bool
+GetVideoRenderDriver(int *index)
+{
+    const char *env = GetConfig()->renderer;
+    SDL_RendererInfo info;
+    int i;
 
-    /* If we're in OpenGL mode, just create a stub surface and we're done! */
-    if (flags & SDL_OPENGL) {
-        SDL_VideoContext = SDL_GL_CreateContext(SDL_VideoWindow);
-        if (!SDL_VideoContext) {
-            return NULL;
-        }
-        if (SDL_GL_MakeCurrent(SDL_VideoWindow, SDL_VideoContext) < 0) {
-            return NULL;
-        }
-        SDL_VideoSurface =
-            SDL_CreateRGBSurfaceFrom(NULL, width, height, bpp, 0, 0, 0, 0, 0);
-        if (!SDL_VideoSurface) {
-            return NULL;
+    if (!env) {
+        return SDL_FALSE;
+    }
+    *index = -1;
+    for (i = 0; i < SDL_GetNumRenderDrivers(); ++i) {
+        if (SDL_GetRenderDriverInfo(i, &info) == 0 &&
+            SDL_strcasecmp(info.name, env) == 0) {
+            *index = i;
+            break;
         }
-        SDL_VideoSurface->flags |= surface_flags;
-        SDL_PublicSurface = SDL_VideoSurface;
-        return SDL_PublicSurface;
     }
+    return SDL_TRUE;
+}
 
-    /* Create the screen surface */
-    SDL_WindowSurface = SDL_GetWindowSurface(SDL_VideoWindow);
-    if (!SDL_WindowSurface) {
-        return NULL;
+/* Pick a texture format the renderer likes, at the requested depth if we
+   can, so the application doesn't need a shadow surface */
+static Uint32
+GetVideoTextureFormat(int bpp)
+{
+    SDL_RendererInfo info;
+    Uint32 format = SDL_PIXELFORMAT_UNKNOWN;
+    Uint32 i;
+
+    if (SDL_GetRendererInfo(SDL_VideoRenderer, &info) == 0) {
+        for (i = 0; i < info.num_texture_formats; ++i) {
+            Uint32 candidate = info.texture_formats[i];
+
+            if (SDL_ISPIXELFORMAT_FOURCC(candidate) ||
+                SDL_ISPIXELFORMAT_INDEXED(candidate) ||
+                SDL_BYTESPERPIXEL(candidate) < 2) {
+                continue;
+            }
+            if (SDL_BITSPERPIXEL(candidate) == bpp) {
+                return candidate;
+            }
+            if (format == SDL_PIXELFORMAT_UNKNOWN) {
+                format = candidate;
+            }
+        }
+    }
+    if (format == SDL_PIXELFORMAT_UNKNOWN) {
+        format = SDL_PIXELFORMAT_ARGB8888;
     }
+    return format;
+}
 
-    /* Center the public surface in the window surface */
-    SDL_GetWindowSize(SDL_VideoWindow, &window_w, &window_h);
-    SDL_VideoViewport.x = (window_w - width)/2;
-    SDL_VideoViewport.y = (window_h - height)/2;
-    SDL_VideoViewport.w = width;
-    SDL_VideoViewport.h = height;
+/* The scaling SDL_COMPAT_SCALE asks for, if the window is fullscreen */
+static int
+GetScaleMode(void)
+{
+    if (!SDL_VideoWindow || (SDL_VideoFlags & SDL_OPENGL) ||
+        !(SDL_GetWindowFlags(SDL_VideoWindow) & SDL_WINDOW_FULLSCREEN)) {
+        return COMPAT_SCALE_NONE;
+    }
+    return GetConfig()->scale;
+}
 
-    SDL_VideoSurface = SDL_CreateRGBSurfaceFrom(NULL, 0, 0, 32, 0, 0, 0, 0, 0);
-    SDL_VideoSurface->flags |= surface_flags;
-    SDL_VideoSurface->flags |= SDL_DONTFREE;
-    SDL_FreeFormat(SDL_VideoSurface->format);
-    SDL_VideoSurface->format = SDL_WindowSurface->format;
-    SDL_VideoSurface->format->refcount++;
-    SDL_VideoSurface->w = width;
-    SDL_VideoSurface->h = height;
-    SDL_VideoSurface->pitch = SDL_WindowSurface->pitch;
-    SDL_VideoSurface->pixels = (void *)((Uint8 *)SDL_WindowSurface->pixels +
-        SDL_VideoViewport.y * SDL_VideoSurface->pitch +
-        SDL_VideoViewport.x  * SDL_VideoSurface->format->BytesPerPixel);
-    SDL_SetClipRect(SDL_VideoSurface, NULL);
+/* Where a width x height screen goes in the window: centred, or as big as
+ *  it fits with the same aspect ratio, in whole multiples for integer
+ *  scaling.
+ */
+static void
+GetVideoViewport(int mode, int width, int height, SDL_Rect * viewport)
+{
+    int window_w, window_h, scale;
 
-    /* Create a shadow surface if necessary */
-    if ((bpp != SDL_VideoSurface->format->BitsPerPixel)
-        && !(flags & SDL_ANYFORMAT)) {
-        SDL_ShadowSurface =
-            SDL_CreateRGBSurface(0, width, height, bpp, 0, 0, 0, 0);
-        if (!SDL_ShadowSurface) {
-            return NULL;
+    SDL_GetWindowSize(SDL_VideoWindow, &window_w, &window_h);
+    viewport->w = width;
+    viewport->h = height;
+    if (mode == COMPAT_SCALE_INTEGER) {
+        scale = SDL_min(window_w / width, window_h / height);
+        if (scale > 1) {
+            viewport->w = width * scale;
+            viewport->h = height * scale;
         }
-        SDL_ShadowSurface->flags |= surface_flags;
-        SDL_ShadowSurface->flags |= SDL_DONTFREE;
-
-        /* 8-bit SDL_ShadowSurface surfaces report that they have exclusive palette */
-        if (SDL_ShadowSurface->format->palette) {
-            SDL_ShadowSurface->flags |= SDL_HWPALETTE;
-            SDL_DitherColors(SDL_ShadowSurface->format->palette->colors,
-                             SDL_ShadowSurface->format->BitsPerPixel);
+    } else if (mode != COMPAT_SCALE_NONE) {
+        if ((Sint64) window_w * height <= (Sint64) window_h * width) {
+            viewport->w = window_w;
+            viewport->h = (int) ((Sint64) height * window_w / width);
+        } else {
+            viewport->w = (int) ((Sint64) width * window_h / height);
+            viewport->h = window_h;
         }
-        SDL_FillRect(SDL_ShadowSurface, NULL,
-            SDL_MapRGB(SDL_ShadowSurface->format, 0, 0, 0));
     }
-    SDL_PublicSurface =
-        (SDL_ShadowSurface ? SDL_ShadowSurface : SDL_VideoSurface);
-
-    ClearVideoSurface();
-
-    /* We're finally done! */
-    return SDL_PublicSurface;
+    viewport->x = (window_w - viewport->w)/2;
+    viewport->y = (window_h - viewport->h)/2;
 }
 
-SDL_Surface *
-SDL_GetVideoSurface(void)
+/* Point the video surface into the window surface, centred, or when
+ *  scaling give it pixels of its own that presenting scales from.
+ */
+static int
+BindVideoSurface(void)
 {
-    return SDL_PublicSurface;
-}
+    SDL_Surface *video = SDL_VideoSurface;
+    int mode = GetScaleMode();
+    void *pixels;
+    int pitch;
 
-int
-SDL_SetAlpha(SDL_Surface * surface, Uint32 flag, Uint8 value)
-{
-    if (flag & SDL_SRCALPHA) {
-        /* According to the docs, value is ignored for alpha surfaces */
-        if (surface->format->Amask) {
-            value = 0xFF;
+    /* The scalers only do 32-bit pixels */
+    if (SDL_WindowSurface->format->BytesPerPixel != 4) {
+        mode = COMPAT_SCALE_NONE;
+    }
+    if (mode != COMPAT_SCALE_NONE && SDL_VideoScale == COMPAT_SCALE_NONE) {
+        pitch = SDL_CalculatePitch(video);
+        pixels = SDL_malloc(video->h * pitch);
+        if (!pixels) {
+            SDL_OutOfMemory();
+            return -1;
         }
-        SDL_SetSurfaceAlphaMod(surface, value);
-        SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_BLEND);
-    } else {
-        SDL_SetSurfaceAlphaMod(surface, 0xFF);
-        SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+        video->pixels = pixels;
+        video->pitch = pitch;
+    } else if (mode == COMPAT_SCALE_NONE && SDL_VideoScale != COMPAT_SCALE_NONE) {
+        SDL_free(video->pixels);
     }
-    SDL_SetSurfaceRLE(surface, (flag & SDL_RLEACCEL));
-
+    SDL_VideoScale = mode;
+
+    GetVideoViewport(mode, video->w, video->h, &SDL_VideoViewport);
+    if (mode == COMPAT_SCALE_NONE) {
+        video->pitch = SDL_WindowSurface->pitch;
+        video->pixels = (void *)((Uint8 *)SDL_WindowSurface->pixels +
+            SDL_VideoViewport.y * video->pitch +
+            SDL_VideoViewport.x  * video->format->BytesPerPixel);
+    }
+    SDL_SetClipRect(video, NULL);
     return 0;
 }
 
-SDL_Surface *
-SDL_DisplayFormat(SDL_Surface * surface)
+/* The renderer does its own scaling, it only needs telling how */
+static void
+SetupTextureScaling(int mode)
 {
-    SDL_PixelFormat *format;
+    GetVideoViewport(mode, SDL_VideoSurface->w, SDL_VideoSurface->h,
+                     &SDL_VideoViewport);
+#if SDL_VERSION_ATLEAST(2, 0, 12)
+    SDL_SetTextureScaleMode(SDL_VideoTexture, mode == COMPAT_SCALE_LINEAR ?
+                            SDL_ScaleModeLinear : SDL_ScaleModeNearest);
+#endif
+}
 
-    if (!SDL_PublicSurface) {
-        SDL_SetError("No video mode has been set");
+/* Room for a surface's pixels after it changed size.  Grows by half again
+ *  at a time and never shrinks, so dragging a window edge doesn't
+ *  reallocate at every step.  The next full SDL_SetVideoMode frees it.
+ */
+static void *
+GrowPixels(void *pixels, size_t * capacity, size_t needed)
+{
+    size_t size;
+
+    if (needed <= *capacity) {
+        return pixels;
+    }
+    size = SDL_max(needed, *capacity + *capacity / 2);
+    pixels = SDL_realloc(pixels, size);
+    if (!pixels) {
+        SDL_OutOfMemory();
         return NULL;
     }
-    format = SDL_PublicSurface->format;
-
-    /* Set the flags appropriate for copying to display surface */
-    return SDL_ConvertSurface(surface, format, SDL_RLEACCEL);
+    *capacity = size;
+    return pixels;
 }
 
-SDL_Surface *
-SDL_DisplayFormatAlpha(SDL_Surface * surface)
+/* (Re)allocate the video surface pixels and the texture they're streamed
+   to.  The video surface keeps its address, the application may have it.
+   Like the pixels, the texture only grows, presenting shows part of it. */
+static int
+SetupVideoTexture(int width, int height, int bpp)
 {
-    SDL_PixelFormat *vf;
-    SDL_PixelFormat *format;
-    SDL_Surface *converted;
-    /* default to ARGB8888 */
-    Uint32 amask = 0xff000000;
-    Uint32 rmask = 0x00ff0000;
-    Uint32 gmask = 0x0000ff00;
-    Uint32 bmask = 0x000000ff;
+    SDL_Texture *texture = NULL;
+    Uint32 format, texture_format, Rmask, Gmask, Bmask, Amask;
+    int depth, texture_w, texture_h;
+    void *pixels;
 
-    if (!SDL_PublicSurface) {
-        SDL_SetError("No video mode has been set");
+    format = GetVideoTextureFormat(bpp);
+    if (!SDL_PixelFormatEnumToMasks(format, &depth,
+                                    &Rmask, &Gmask, &Bmask, &Amask)) {
+        return -1;
+    }
+    if (SDL_VideoTexture &&
+        SDL_QueryTexture(SDL_VideoTexture, &texture_format, NULL,
+                         &texture_w, &texture_h) == 0 &&
+        texture_format == format) {
+        if (texture_w >= width && texture_h >= height) {
+            texture = SDL_VideoTexture;
+        } else {
+            texture_w = SDL_max(width, texture_w + texture_w / 2);
+            texture_h = SDL_max(height, texture_h + texture_h / 2);
+            texture = SDL_CreateTexture(SDL_VideoRenderer, format,
+                                        SDL_TEXTUREACCESS_STREAMING,
+                                        texture_w, texture_h);
+        }
+    }
+    if (!texture) {
+        texture = SDL_CreateTexture(SDL_VideoRenderer, format,
+                                    SDL_TEXTUREACCESS_STREAMING, width, height);
+    }
+    if (!texture) {
+        return -1;
+    }
+    /* Any alpha channel is just padding as far as the screen is concerned */
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
+
+    if (!SDL_VideoSurface) {
+        SDL_VideoSurface = SDL_CreateRGBSurfaceFrom(NULL, 0, 0, depth, 0,
+                                                    Rmask, Gmask, Bmask, 0);
+        if (!SDL_VideoSurface) {
+            SDL_DestroyTexture(texture);
+            return -1;
+        }
+        SDL_VideoSurface->flags |= SDL_DONTFREE;
+        SDL_VideoCapacity = 0;
+    }
+    SDL_VideoSurface->w = width;
+    SDL_VideoSurface->h = height;
+    SDL_VideoSurface->pitch = SDL_CalculatePitch(SDL_VideoSurface);
+    pixels = GrowPixels(SDL_VideoSurface->pixels, &SDL_VideoCapacity,
+                        (size_t) SDL_VideoSurface->h * SDL_VideoSurface->pitch);
+    if (!pixels) {
+        if (texture != SDL_VideoTexture) {
+            SDL_DestroyTexture(texture);
+        }
+        return -1;
+    }
+    SDL_VideoSurface->pixels = pixels;
+    SDL_SetClipRect(SDL_VideoSurface, NULL);
+
+    if (SDL_VideoTexture && SDL_VideoTexture != texture) {
+        SDL_DestroyTexture(SDL_VideoTexture);
+    }
+    SDL_VideoTexture = texture;
+    return 0;
+}
+
+/* Upload the dirty parts of the video surface and put it on screen */
+static void
+SDL_PresentTexture(int numrects, const SDL_Rect * rects)
+{
+    SDL_Rect used;
+    int i;
+
+    for (i = 0; i < numrects; ++i) {
+        SDL_UpdateTexture(SDL_VideoTexture, &rects[i],
+                          (Uint8 *) SDL_VideoSurface->pixels +
+                          rects[i].y * SDL_VideoSurface->pitch +
+                          rects[i].x * SDL_VideoSurface->format->BytesPerPixel,
+                          SDL_VideoSurface->pitch);
+    }
+
+    /* Unlike the window surface, the borders don't stay black by themselves */
+    SDL_SetRenderDrawColor(SDL_VideoRenderer, 0, 0, 0, 0xFF);
+    SDL_RenderClear(SDL_VideoRenderer);
+    used.x = 0;
+    used.y = 0;
+    used.w = SDL_VideoSurface->w;
+    used.h = SDL_VideoSurface->h;
+    SDL_RenderCopy(SDL_VideoRenderer, SDL_VideoTexture, &used,
+                   &SDL_VideoViewport);
+    SDL_RenderPresent(SDL_VideoRenderer);
+}
+
+static void
+ClearVideoSurface()
+{
+    if (SDL_ShadowSurface) {
+        SDL_FillRect(SDL_ShadowSurface, NULL,
+            SDL_MapRGB(SDL_ShadowSurface->format, 0, 0, 0));
+    }
+    if (SDL_VideoRenderer) {
+        SDL_Rect rect;
+
+        SDL_FillRect(SDL_VideoSurface, NULL, 0);
+        rect.x = 0;
+        rect.y = 0;
+        rect.w = SDL_VideoSurface->w;
+        rect.h = SDL_VideoSurface->h;
+        SDL_PresentTexture(1, &rect);
+        return;
+    }
+    if (SDL_VideoScale) {
+        SDL_FillRect(SDL_VideoSurface, NULL, 0);
+    }
+    SDL_FillRect(SDL_WindowSurface, NULL, 0);
+    SDL_UpdateWindowSurface(SDL_VideoWindow);
+}
+
+static void
+SetupScreenSaver(int flags)
+{
+    int env = GetConfig()->allow_screensaver;
+    SDL_bool allow_screensaver;
+
+    /* Allow environment override of screensaver disable */
+    if (env >= 0) {
+        allow_screensaver = env ? SDL_TRUE : SDL_FALSE;
+    } else if (flags & SDL_FULLSCREEN) {
+        allow_screensaver = SDL_FALSE;
+    } else {
+        allow_screensaver = SDL_TRUE;
+    }
+    if (allow_screensaver) {
+        SDL_EnableScreenSaver();
+    } else {
+        SDL_DisableScreenSaver();
+    }
+}
+
+static void
+SetupUpdateCoverage(void)
+{
+    /* Percentage of the screen that has to be dirty before SDL_UpdateRects
+       updates all of it in one go */
+    SDL_UpdateCoverage = GetConfig()->update_coverage;
+}
+
+static void
+SetupDeferredPresent(void)
+{
+    /* Hold SDL_UpdateRect(s) back for up to this many milliseconds, and
+       present them together on SDL_Flip or the next event poll */
+    SDL_DeferredPresent = GetConfig()->deferred_present;
+}
+
+static void
+SetupMotionCoalescing(void)
+{
+    /* Merge runs of mouse motion events, for very high rate mice */
+    SDL_CoalesceMotion = GetConfig()->coalesce_motion;
+}
+
+static void
+SetupWheelThreshold(void)
+{
+    /* How far the wheel has to turn, in notches, for a wheel button click */
+    SDL_WheelThreshold = GetConfig()->wheel_threshold;
+}
+
+static void
+SetupConvertThreads(void)
+{
+    /* Worker threads for converting big shadow surface updates */
+    if (GetConfig()->convert_threads >= 0) {
+        SDL_InitWorkers(GetConfig()->convert_threads);
+    }
+}
+
+/* Resizing happens in storms while a window edge is dragged, so this only
+ *  does what the new size needs right away.  Buffers grow geometrically,
+ *  and putting the whole new screen up waits for the next present.
+ */
+static int
+SDL_ResizeVideoMode(int width, int height, int bpp, Uint32 flags)
+{
+    void *pixels;
+    size_t size;
+    int w, h;
+
+    /* We can't resize something we don't have... */
+    if (!SDL_VideoSurface) {
+        return -1;
+    }
+
+    /* We probably have to recreate the window in fullscreen mode */
+    if (flags & SDL_FULLSCREEN) {
+        return -1;
+    }
+
+    /* I don't think there's any change we can gracefully make in flags */
+    if (flags != SDL_VideoFlags) {
+        return -1;
+    }
+    if (bpp != SDL_VideoSurface->format->BitsPerPixel) {
+        return -1;
+    }
+    if (SDL_VideoScale || GetScaleMode() != COMPAT_SCALE_NONE) {
+        return -1;
+    }
+
+    /* Resize the window */
+    SDL_GetWindowSize(SDL_VideoWindow, &w, &h);
+    if (w != width || h != height) {
+        SDL_SetWindowSize(SDL_VideoWindow, width, height);
+    }
+
+    /* If we're in OpenGL mode, just resize the stub surface and we're done! */
+    if (flags & SDL_OPENGL) {
+        SDL_VideoSurface->w = width;
+        SDL_VideoSurface->h = height;
+        SDL_VideoViewport.x = 0;
+        SDL_VideoViewport.y = 0;
+        SDL_VideoViewport.w = width;
+        SDL_VideoViewport.h = height;
+        return 0;
+    }
+
+    /* The window may not have taken the size, e.g. in desktop fullscreen */
+    SDL_GetWindowSize(SDL_VideoWindow, &w, &h);
+    SDL_VideoViewport.x = (w - width)/2;
+    SDL_VideoViewport.y = (h - height)/2;
+    SDL_VideoViewport.w = width;
+    SDL_VideoViewport.h = height;
+
+    if (SDL_VideoRenderer) {
+        if (SetupVideoTexture(width, height, bpp) < 0) {
+            return -1;
+        }
+    } else {
+        SDL_WindowSurface = SDL_GetWindowSurface(SDL_VideoWindow);
+        if (!SDL_WindowSurface) {
+            return -1;
+        }
+        if (SDL_VideoSurface->format != SDL_WindowSurface->format ||
+            SDL_VideoViewport.x < 0 || SDL_VideoViewport.y < 0) {
+            return -1;
+        }
+        SDL_VideoSurface->w = width;
+        SDL_VideoSurface->h = height;
+        SDL_VideoSurface->pitch = SDL_WindowSurface->pitch;
+        SDL_VideoSurface->pixels = (void *)((Uint8 *)SDL_WindowSurface->pixels +
+            SDL_VideoViewport.y * SDL_VideoSurface->pitch +
+            SDL_VideoViewport.x  * SDL_VideoSurface->format->BytesPerPixel);
+        SDL_SetClipRect(SDL_VideoSurface, NULL);
+    }
+
+    if (SDL_ShadowSurface) {
+        /* It holds at least what it was last sized for */
+        size = (size_t) SDL_ShadowSurface->h * SDL_ShadowSurface->pitch;
+        SDL_ShadowCapacity = SDL_max(SDL_ShadowCapacity, size);
+
+        SDL_ShadowSurface->w = width;
+        SDL_ShadowSurface->h = height;
+        SDL_ShadowSurface->pitch = SDL_CalculatePitch(SDL_ShadowSurface);
+        pixels = GrowPixels(SDL_ShadowSurface->pixels, &SDL_ShadowCapacity,
+                            (size_t) SDL_ShadowSurface->h *
+                            SDL_ShadowSurface->pitch);
+        if (!pixels) {
+            return -1;
+        }
+        SDL_ShadowSurface->pixels = pixels;
+        SDL_SetClipRect(SDL_ShadowSurface, NULL);
+    } else {
+        SDL_PublicSurface = SDL_VideoSurface;
+    }
+
+    /* A black screen to draw on, it reaches the window with the next present */
+    if (SDL_ShadowSurface) {
+        SDL_FillRect(SDL_ShadowSurface, NULL,
+            SDL_MapRGB(SDL_ShadowSurface->format, 0, 0, 0));
+    }
+    SDL_FillRect(SDL_VideoRenderer ? SDL_VideoSurface : SDL_WindowSurface,
+                 NULL, 0);
+    SDL_ResizePending = SDL_TRUE;
+
+    return 0;
+}
+
+SDL_Surface *
+SDL_SetVideoMode(int width, int height, int bpp, Uint32 flags)
+{
+    SDL_DisplayMode desktop_mode;
+    int display;
+    int window_x;
+    int window_y;
+    int render_driver;
+    Uint32 window_flags;
+    Uint32 surface_flags;
+    COMPAT_TRACE("SDL_SetVideoMode");
+
+    /* Pick up anything set with putenv() since the last mode */
+    SDL_ConfigStale = SDL_TRUE;
+    display = GetVideoDisplay();
+    window_x = SDL_WINDOWPOS_UNDEFINED_DISPLAY(display);
+    window_y = SDL_WINDOWPOS_UNDEFINED_DISPLAY(display);
+
+    if (!SDL_WasInit(SDL_INIT_VIDEO)) {
+        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_NOPARACHUTE) < 0) {
+            return NULL;
+        }
+    }
+
+    if (GetModeCache()) {
+        desktop_mode = SDL_ModeCache.desktop;
+    } else {
+        SDL_GetDesktopDisplayMode(display, &desktop_mode);
+    }
+
+    if (width == 0) {
+        width = desktop_mode.w;
+    }
+    if (height == 0) {
+        height = desktop_mode.h;
+    }
+    if (bpp == 0) {
+        bpp = SDL_BITSPERPIXEL(desktop_mode.format);
+    }
+
+    /* Updates for the old screen are pointless now */
+    SDL_NumPendingRects = 0;
+    SDL_PendingScreen = NULL;
+
+    ++SDL_VideoModeSerial;
+    SDL_VideoThread = SDL_ThreadID();
+    SetupUpdateCoverage();
+    SetupDeferredPresent();
+    SetupConvertThreads();
+    SetupMotionCoalescing();
+    SetupWheelThreshold();
+
+    /* See if we can simply resize the existing window and surface, the
+       present thread keeps going once it's done */
+    PauseAsyncPresent();
+    if (SDL_ResizeVideoMode(width, height, bpp, flags) == 0) {
+        ResumeAsyncPresent(SDL_TRUE);
+        SetupAsyncPresent(flags);
+        return SDL_PublicSurface;
+    }
+    ResumeAsyncPresent(SDL_FALSE);
+    StopAsyncPresent();
+
+    /* Destroy existing window */
+    SDL_PublicSurface = NULL;
+    if (SDL_ShadowSurface) {
+        SDL_ShadowSurface->flags &= ~SDL_DONTFREE;
+        SDL_FreeSurface(SDL_ShadowSurface);
+        SDL_ShadowSurface = NULL;
+    }
+    SDL_ShadowCapacity = 0;
+    SDL_VideoCapacity = 0;
+    SDL_ResizePending = SDL_FALSE;
+    if (SDL_VideoSurface) {
+        if (SDL_VideoRenderer || SDL_VideoScale) {
+            /* These pixels were ours, not the window's */
+            SDL_free(SDL_VideoSurface->pixels);
+        }
+        SDL_VideoSurface->flags &= ~SDL_DONTFREE;
+        SDL_FreeSurface(SDL_VideoSurface);
+        SDL_VideoSurface = NULL;
+    }
+    SDL_VideoScale = COMPAT_SCALE_NONE;
+    if (SDL_VideoTexture) {
+        SDL_DestroyTexture(SDL_VideoTexture);
+        SDL_VideoTexture = NULL;
+    }
+    if (SDL_VideoRenderer) {
+        SDL_DestroyRenderer(SDL_VideoRenderer);
+        SDL_VideoRenderer = NULL;
+    }
+    if (SDL_VideoContext) {
+        /* SDL_GL_MakeCurrent(0, NULL); *//* Doesn't do anything */
+        SDL_GL_DeleteContext(SDL_VideoContext);
+        SDL_VideoContext = NULL;
+    }
+    if (SDL_VideoWindow) {
+        SDL_GetWindowPosition(SDL_VideoWindow, &window_x, &window_y);
+        SDL_DestroyWindow(SDL_VideoWindow);
+    }
+
+    /* Create a new window */
+    window_flags = SDL_WINDOW_SHOWN;
+    if ((flags & SDL_FULLSCREEN) && GetConfig()->scale &&
+        !(flags & SDL_OPENGL)) {
+        /* Scaled to the desktop instead of changing modes */
+        window_flags |= SDL_WINDOW_FULLSCREEN_DESKTOP;
+    } else if (flags & SDL_FULLSCREEN) {
+        window_flags |= SDL_WINDOW_FULLSCREEN;
+    }
+    if (flags & SDL_OPENGL) {
+        window_flags |= SDL_WINDOW_OPENGL;
+    }
+    if (flags & SDL_RESIZABLE) {
+        window_flags |= SDL_WINDOW_RESIZABLE;
+    }
+    if (flags & SDL_NOFRAME) {
+        window_flags |= SDL_WINDOW_BORDERLESS;
+    }
+    GetEnvironmentWindowPosition(width, height, &window_x, &window_y);
+    SDL_VideoWindow =
+        SDL_CreateWindow(wm_title, window_x, window_y, width, height,
+                         window_flags);
+    if (!SDL_VideoWindow) {
         return NULL;
     }
-    vf = SDL_PublicSurface->format;
+    SDL_SetWindowIcon(SDL_VideoWindow, SDL_VideoIcon);
+
+    SetupScreenSaver(flags);
+
+    window_flags = SDL_GetWindowFlags(SDL_VideoWindow);
+    surface_flags = 0;
+    if (window_flags & SDL_WINDOW_FULLSCREEN) {
+        surface_flags |= SDL_FULLSCREEN;
+    }
+    if ((window_flags & SDL_WINDOW_OPENGL) && (flags & SDL_OPENGL)) {
+        surface_flags |= SDL_OPENGL;
+    }
+    if (window_flags & SDL_WINDOW_RESIZABLE) {
+        surface_flags |= SDL_RESIZABLE;
+    }
+    if (window_flags & SDL_WINDOW_BORDERLESS) {
+        surface_flags |= SDL_NOFRAME;
+    }
+
+    SDL_VideoFlags = flags;
+
+    /* If we're in OpenGL mode, just create a stub surface and we're done! */
+    if (flags & SDL_OPENGL) {
+        SDL_VideoContext = SDL_GL_CreateContext(SDL_VideoWindow);
+        if (!SDL_VideoContext) {
+            return NULL;
+        }
+        if (SDL_GL_MakeCurrent(SDL_VideoWindow, SDL_VideoContext) < 0) {
+            return NULL;
+        }
+        SDL_VideoSurface =
+            SDL_CreateRGBSurfaceFrom(NULL, width, height, bpp, 0, 0, 0, 0, 0);
+        if (!SDL_VideoSurface) {
+            return NULL;
+        }
+        SDL_VideoSurface->flags |= surface_flags;
+        SDL_VideoViewport.x = 0;
+        SDL_VideoViewport.y = 0;
+        SDL_VideoViewport.w = width;
+        SDL_VideoViewport.h = height;
+        SDL_PublicSurface = SDL_VideoSurface;
+        return SDL_PublicSurface;
+    }
+
+    /* Present through a streaming texture if we've been asked to */
+    if (GetVideoRenderDriver(&render_driver)) {
+        SDL_VideoRenderer =
+            SDL_CreateRenderer(SDL_VideoWindow, render_driver, 0);
+    }
+    if (SDL_VideoRenderer) {
+        if (SetupVideoTexture(width, height, bpp) < 0) {
+            return NULL;
+        }
+        SDL_VideoSurface->flags |= surface_flags;
+        SetupTextureScaling(GetScaleMode());
+    } else {
+        /* Create the screen surface */
+        SDL_WindowSurface = SDL_GetWindowSurface(SDL_VideoWindow);
+        if (!SDL_WindowSurface) {
+            return NULL;
+        }
+
+        SDL_VideoSurface = SDL_CreateRGBSurfaceFrom(NULL, 0, 0, 32, 0, 0, 0, 0, 0);
+        SDL_VideoSurface->flags |= surface_flags;
+        SDL_VideoSurface->flags |= SDL_DONTFREE;
+        SDL_FreeFormat(SDL_VideoSurface->format);
+        SDL_VideoSurface->format = SDL_WindowSurface->format;
+        SDL_VideoSurface->format->refcount++;
+        SDL_VideoSurface->w = width;
+        SDL_VideoSurface->h = height;
+        if (BindVideoSurface() < 0) {
+            return NULL;
+        }
+    }
+
+    /* Create a shadow surface if necessary */
+    if ((bpp != SDL_VideoSurface->format->BitsPerPixel)
+        && !(flags & SDL_ANYFORMAT)) {
+        SDL_ShadowSurface =
+            SDL_CreateRGBSurface(0, width, height, bpp, 0, 0, 0, 0);
+        if (!SDL_ShadowSurface) {
+            return NULL;
+        }
+        SDL_ShadowSurface->flags |= surface_flags;
+        SDL_ShadowSurface->flags |= SDL_DONTFREE;
+
+        /* 8-bit SDL_ShadowSurface surfaces report that they have exclusive palette */
+        if (SDL_ShadowSurface->format->palette) {
+            SDL_ShadowSurface->flags |= SDL_HWPALETTE;
+            SDL_DitherColors(SDL_ShadowSurface->format->palette->colors,
+                             SDL_ShadowSurface->format->BitsPerPixel);
+        }
+        SDL_FillRect(SDL_ShadowSurface, NULL,
+            SDL_MapRGB(SDL_ShadowSurface->format, 0, 0, 0));
+    }
+    SDL_PublicSurface =
+        (SDL_ShadowSurface ? SDL_ShadowSurface : SDL_VideoSurface);
+
+    ClearVideoSurface();
+    SetupAsyncPresent(flags);
+
+    /* We're finally done! */
+    return SDL_PublicSurface;
+}
+
+SDL_Surface *
+SDL_GetVideoSurface(void)
+{
+    return SDL_PublicSurface;
+}
+
+/* RLE only pays for itself when blits can skip or copy long runs, and
+ *  every SDL_LockSurface() decodes and re-encodes the whole surface.
+ */
+#define COMPAT_RLE_SAMPLE_ROWS  32
+#define COMPAT_RLE_MIN_RUN      8       /* Average pixels per run */
+
+/* Set on surfaces SDL_ChooseRLE() has decided for, in a bit SDL 2.0 doesn't
+   use, so asking for RLE again doesn't sample them again */
+#define SDL_COMPAT_RLECHOSEN    0x00040000
+
+static Uint32
+ReadPixel(const Uint8 * p, int bpp)
+{
+    switch (bpp) {
+    case 1:
+        return *p;
+    case 2:
+        return *(const Uint16 *) p;
+    case 3:
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+        return p[0] | (p[1] << 8) | (p[2] << 16);
+#else
+        return (p[0] << 16) | (p[1] << 8) | p[2];
+#endif
+    default:
+        return *(const Uint32 *) p;
+    }
+}
+
+/* Turn RLE on or off for a surface, depending on whether its transparent,
+ *  opaque and translucent pixels come in runs long enough to be worth it.
+ *  Samples a few evenly spaced rows rather than the whole surface.
+ */
+static SDL_bool
+SDL_ChooseRLE(SDL_Surface * surface)
+{
+    SDL_BlendMode blend = SDL_BLENDMODE_NONE;
+    Uint32 key = 0, amask = 0, pixel;
+    SDL_bool colorkey, rle = SDL_FALSE;
+    int bpp = surface->format->BytesPerPixel;
+    int rows, runs = 0, translucent = 0, sampled = 0;
+    int i, x, kind, last;
+    const Uint8 *row;
+
+    colorkey = (SDL_GetColorKey(surface, &key) == 0);
+    SDL_GetSurfaceBlendMode(surface, &blend);
+    if (blend == SDL_BLENDMODE_BLEND) {
+        amask = surface->format->Amask;
+    }
+
+    /* Nothing for RLE to skip in a plain opaque copy */
+    if ((colorkey || amask) && surface->w > 0 && surface->h > 0) {
+        if (SDL_MUSTLOCK(surface)) {
+            SDL_LockSurface(surface);
+        }
+        rows = SDL_min(surface->h, COMPAT_RLE_SAMPLE_ROWS);
+        for (i = 0; i < rows; ++i) {
+            row = (const Uint8 *) surface->pixels +
+                (i * surface->h / rows) * surface->pitch;
+            last = -1;
+            for (x = 0; x < surface->w; ++x, row += bpp) {
+                pixel = ReadPixel(row, bpp);
+                /* 0 transparent, 1 opaque, 2 translucent */
+                if ((colorkey && pixel == key) || (amask && !(pixel & amask))) {
+                    kind = 0;
+                } else if (!amask || (pixel & amask) == amask) {
+                    kind = 1;
+                } else {
+                    kind = 2;
+                    ++translucent;
+                }
+                if (kind != last) {
+                    ++runs;
+                    last = kind;
+                }
+            }
+            sampled += surface->w;
+        }
+        if (SDL_MUSTLOCK(surface)) {
+            SDL_UnlockSurface(surface);
+        }
+        rle = (sampled >= runs * COMPAT_RLE_MIN_RUN &&
+               translucent * 2 <= sampled);
+    }
+
+    SDL_SetSurfaceRLE(surface, rle);
+    surface->flags |= SDL_COMPAT_RLECHOSEN;
+    if (rle) {
+        COMPAT_METRIC_ADD(rle_surfaces, 1);
+    } else {
+        COMPAT_METRIC_ADD(plain_surfaces, 1);
+    }
+    return rle;
+}
+
+int
+SDL_SetAlpha(SDL_Surface * surface, Uint32 flag, Uint8 value)
+{
+    SDL_BlendMode blend = SDL_BLENDMODE_NONE;
+
+    SDL_GetSurfaceBlendMode(surface, &blend);
+    if (flag & SDL_SRCALPHA) {
+        /* According to the docs, value is ignored for alpha surfaces */
+        if (surface->format->Amask) {
+            value = 0xFF;
+        }
+        SDL_SetSurfaceAlphaMod(surface, value);
+        SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_BLEND);
+    } else {
+        SDL_SetSurfaceAlphaMod(surface, 0xFF);
+        SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+    }
+    /* Blending decides which pixels RLE can skip */
+    if (blend != ((flag & SDL_SRCALPHA) ? SDL_BLENDMODE_BLEND :
+                  SDL_BLENDMODE_NONE)) {
+        surface->flags &= ~SDL_COMPAT_RLECHOSEN;
+    }
+    if (flag & SDL_RLEACCEL) {
+        /* Fades call this every frame, and sampling an RLE surface decodes
+           and re-encodes it, so only sample ones not decided yet */
+        if (!(surface->flags & (SDL_RLEACCEL | SDL_COMPAT_RLECHOSEN))) {
+            SDL_ChooseRLE(surface);
+        }
+    } else {
+        SDL_SetSurfaceRLE(surface, 0);
+        surface->flags &= ~SDL_COMPAT_RLECHOSEN;
+    }
+
+    return 0;
+}
+
+static SDL_Surface *SDL_ConvertSurfaceFast(SDL_Surface * surface,
+                                           SDL_PixelFormat * format);
+
+static SDL_Surface *
+ConvertToDisplayFormat(SDL_Surface * surface, SDL_PixelFormat * format)
+{
+    SDL_Surface *converted = SDL_ConvertSurfaceFast(surface, format);
+
+    if (!converted) {
+        converted = SDL_ConvertSurface(surface, format, 0);
+    }
+    if (converted) {
+        SDL_ChooseRLE(converted);
+    }
+    return converted;
+}
+
+SDL_Surface *
+SDL_DisplayFormat(SDL_Surface * surface)
+{
+    SDL_PixelFormat *format;
+
+    if (!SDL_PublicSurface) {
+        SDL_SetError("No video mode has been set");
+        return NULL;
+    }
+    format = SDL_PublicSurface->format;
+
+    /* Set the flags appropriate for copying to display surface */
+    return ConvertToDisplayFormat(surface, format);
+}
+
+/* The format SDL_DisplayFormatAlpha() converts to, made once per mode */
+static SDL_PixelFormat *SDL_DisplayAlphaFormat = NULL;
+static Uint32 SDL_DisplayAlphaSerial = 0;
+
+static SDL_PixelFormat *
+GetDisplayAlphaFormat(void)
+{
+    SDL_PixelFormat *vf;
+    /* default to ARGB8888 */
+    Uint32 amask = 0xff000000;
+    Uint32 rmask = 0x00ff0000;
+    Uint32 gmask = 0x0000ff00;
+    Uint32 bmask = 0x000000ff;
+
+    if (!SDL_PublicSurface) {
+        SDL_SetError("No video mode has been set");
+        return NULL;
+    }
+    if (SDL_DisplayAlphaFormat &&
+        SDL_DisplayAlphaSerial == SDL_VideoModeSerial) {
+        return SDL_DisplayAlphaFormat;
+    }
+    vf = SDL_PublicSurface->format;
+
+    switch (vf->BytesPerPixel) {
+    case 2:
+        /* For XGY5[56]5, use, AXGY8888, where {X, Y} = {R, B}.
+           For anything else (like ARGB4444) it doesn't matter
+           since we have no special code for it anyway */
+        if ((vf->Rmask == 0x1f) &&
+            (vf->Bmask == 0xf800 || vf->Bmask == 0x7c00)) {
+            rmask = 0xff;
+            bmask = 0xff0000;
+        }
+        break;
+
+    case 3:
+    case 4:
+        /* Keep the video format, as long as the high 8 bits are
+           unused or alpha */
+        if ((vf->Rmask == 0xff) && (vf->Bmask == 0xff0000)) {
+            rmask = 0xff;
+            bmask = 0xff0000;
+        }
+        break;
+
+    default:
+        /* We have no other optimised formats right now. When/if a new
+           optimised alpha format is written, add the converter here */
+        break;
+    }
+    if (SDL_DisplayAlphaFormat) {
+        SDL_FreeFormat(SDL_DisplayAlphaFormat);
+    }
+    SDL_DisplayAlphaFormat = SDL_AllocFormat(SDL_MasksToPixelFormatEnum(32, rmask,
+                                                                        gmask,
+                                                                        bmask,
+                                                                        amask));
+    SDL_DisplayAlphaSerial = SDL_VideoModeSerial;
+    return SDL_DisplayAlphaFormat;
+}
+
+SDL_Surface *
+SDL_DisplayFormatAlpha(SDL_Surface * surface)
+{
+    SDL_PixelFormat *format = GetDisplayAlphaFormat();
+
+    if (!format) {
+        return NULL;
+    }
+    return ConvertToDisplayFormat(surface, format);
+}
+
+int
+SDL_Flip(SDL_Surface * screen)
+{
+    COMPAT_TRACE("SDL_Flip");
+
+    SDL_CountFlip();
+    if (SDL_Flipper.thread && screen == SDL_PublicSurface) {
+        return SDL_AsyncFlip(screen);
+    }
+    SDL_UpdateRect(screen, 0, 0, 0, 0);
+    SDL_FlushUpdates();
+    return 0;
+}
+
+void
+SDL_UpdateRect(SDL_Surface * screen, Sint32 x, Sint32 y, Uint32 w, Uint32 h)
+{
+    if (screen) {
+        SDL_Rect rect;
+
+        /* Fill the rectangle */
+        rect.x = (int) x;
+        rect.y = (int) y;
+        rect.w = (int) (w ? w : screen->w);
+        rect.h = (int) (h ? h : screen->h);
+        SDL_UpdateRects(screen, 1, &rect);
+    }
+}
+
+/* === Worker threads === */
+
+/* A small pool for splitting work that's too big for one core.  Jobs are
+ *  numbered, the caller runs them alongside the workers and returns once
+ *  all of them are done.  One batch runs at a time.
+ */
+typedef void (*SDL_JobFunc) (void *data, int job);
+
+static struct
+{
+    SDL_Thread **threads;
+    int numthreads;
+    SDL_mutex *batch;           /* Held by whoever is running a batch */
+    SDL_mutex *lock;            /* Protects everything below */
+    SDL_cond *wake;
+    SDL_cond *done;
+    SDL_JobFunc func;
+    void *data;
+    int next;                   /* Next job nobody has started */
+    int count;
+    int pending;                /* Jobs not finished yet */
+    SDL_bool quit;
+} SDL_Workers;
+
+static int SDLCALL
+SDL_WorkerThread(void *unused)
+{
+    SDL_LockMutex(SDL_Workers.lock);
+    for (;;) {
+        int job;
+
+        while (!SDL_Workers.quit && SDL_Workers.next >= SDL_Workers.count) {
+            SDL_CondWait(SDL_Workers.wake, SDL_Workers.lock);
+        }
+        if (SDL_Workers.quit) {
+            break;
+        }
+        job = SDL_Workers.next++;
+        SDL_UnlockMutex(SDL_Workers.lock);
+
+        SDL_Workers.func(SDL_Workers.data, job);
+
+        SDL_LockMutex(SDL_Workers.lock);
+        if (--SDL_Workers.pending == 0) {
+            SDL_CondSignal(SDL_Workers.done);
+        }
+    }
+    SDL_UnlockMutex(SDL_Workers.lock);
+    return 0;
+}
+
+static void
+SDL_InitWorkers(int numthreads)
+{
+    int i;
+
+    if (SDL_Workers.threads || numthreads <= 0) {
+        return;
+    }
+
+    SDL_Workers.batch = SDL_CreateMutex();
+    SDL_Workers.lock = SDL_CreateMutex();
+    SDL_Workers.wake = SDL_CreateCond();
+    SDL_Workers.done = SDL_CreateCond();
+    SDL_Workers.threads =
+        (SDL_Thread **) SDL_calloc(numthreads, sizeof(SDL_Thread *));
+    if (!SDL_Workers.batch || !SDL_Workers.lock || !SDL_Workers.wake ||
+        !SDL_Workers.done || !SDL_Workers.threads) {
+        /* Everything just runs on the calling thread */
+        return;
+    }
+    for (i = 0; i < numthreads; ++i) {
+        SDL_Workers.threads[i] =
+            SDL_CreateThread(SDL_WorkerThread, "SDL_compat worker", NULL);
+        if (!SDL_Workers.threads[i]) {
+            break;
+        }
+    }
+    SDL_Workers.numthreads = i;
+}
+
+/* Joins the workers and frees the pool, so the next SDL_Init starts over */
+static void
+StopWorkers(void)
+{
+    int i;
+
+    if (SDL_Workers.lock && SDL_Workers.wake) {
+        SDL_LockMutex(SDL_Workers.lock);
+        SDL_Workers.quit = SDL_TRUE;
+        SDL_CondBroadcast(SDL_Workers.wake);
+        SDL_UnlockMutex(SDL_Workers.lock);
+    }
+    for (i = 0; i < SDL_Workers.numthreads; ++i) {
+        SDL_WaitThread(SDL_Workers.threads[i], NULL);
+    }
+    if (SDL_Workers.threads) {
+        SDL_free(SDL_Workers.threads);
+    }
+    if (SDL_Workers.batch) {
+        SDL_DestroyMutex(SDL_Workers.batch);
+    }
+    if (SDL_Workers.lock) {
+        SDL_DestroyMutex(SDL_Workers.lock);
+    }
+    if (SDL_Workers.wake) {
+        SDL_DestroyCond(SDL_Workers.wake);
+    }
+    if (SDL_Workers.done) {
+        SDL_DestroyCond(SDL_Workers.done);
+    }
+    SDL_zero(SDL_Workers);
+}
+
+static void
+SDL_RunJobs(SDL_JobFunc func, void *data, int count)
+{
+    int job;
+
+    if (SDL_Workers.numthreads == 0 || count <= 1) {
+        for (job = 0; job < count; ++job) {
+            func(data, job);
+        }
+        return;
+    }
+
+    SDL_LockMutex(SDL_Workers.batch);
+    SDL_LockMutex(SDL_Workers.lock);
+    SDL_Workers.func = func;
+    SDL_Workers.data = data;
+    SDL_Workers.next = 0;
+    SDL_Workers.count = count;
+    SDL_Workers.pending = count;
+    SDL_CondBroadcast(SDL_Workers.wake);
+
+    /* Lend a hand rather than sit idle */
+    while (SDL_Workers.next < SDL_Workers.count) {
+        job = SDL_Workers.next++;
+        SDL_UnlockMutex(SDL_Workers.lock);
+        func(data, job);
+        SDL_LockMutex(SDL_Workers.lock);
+        --SDL_Workers.pending;
+    }
+    while (SDL_Workers.pending > 0) {
+        SDL_CondWait(SDL_Workers.done, SDL_Workers.lock);
+    }
+    SDL_UnlockMutex(SDL_Workers.lock);
+    SDL_UnlockMutex(SDL_Workers.batch);
+}
+
+/* Each job converts a run of the surfaces */
+typedef struct
+{
+    SDL_Surface **surfaces;
+    SDL_Surface **converted;
+    int numsurfaces;
+    int numjobs;
+    SDL_PixelFormat *format;
+} SDL_ConvertBatch;
+
+static void
+SDL_ConvertBatchJob(void *data, int job)
+{
+    SDL_ConvertBatch *batch = (SDL_ConvertBatch *) data;
+    int i = (int) ((Sint64) batch->numsurfaces * job / batch->numjobs);
+    int end = (int) ((Sint64) batch->numsurfaces * (job + 1) / batch->numjobs);
+    COMPAT_TRACE("SDL_ConvertBatchJob");
+
+    for (; i < end; ++i) {
+        if (batch->surfaces[i]) {
+            batch->converted[i] =
+                ConvertToDisplayFormat(batch->surfaces[i], batch->format);
+        }
+    }
+}
+
+SDL_Surface **
+SDL_DisplayFormatArray(SDL_Surface ** surfaces, int numsurfaces, int alpha)
+{
+    SDL_ConvertBatch batch;
+    COMPAT_TRACE("SDL_DisplayFormatArray");
+
+    if (!surfaces || numsurfaces < 0) {
+        SDL_SetError("Invalid surface array");
+        return NULL;
+    }
+    if (!SDL_PublicSurface) {
+        SDL_SetError("No video mode has been set");
+        return NULL;
+    }
+    batch.format = alpha ? GetDisplayAlphaFormat() : SDL_PublicSurface->format;
+    if (!batch.format) {
+        return NULL;
+    }
+    batch.converted =
+        (SDL_Surface **) SDL_calloc(SDL_max(numsurfaces, 1),
+                                    sizeof(*batch.converted));
+    if (!batch.converted) {
+        SDL_OutOfMemory();
+        return NULL;
+    }
+
+    /* Asking for a batch is asking for threads, unless told how many */
+    if (GetConfig()->convert_threads < 0) {
+        SDL_InitWorkers(SDL_GetCPUCount() - 1);
+    }
+
+    batch.surfaces = surfaces;
+    batch.numsurfaces = numsurfaces;
+    batch.numjobs = SDL_min(numsurfaces, (SDL_Workers.numthreads + 1) * 4);
+    SDL_RunJobs(SDL_ConvertBatchJob, &batch, batch.numjobs);
+    return batch.converted;
+}
+
+/* === Pixel conversion kernels === */
+
+/* Converters for the shadow surface formats SDL_SetVideoMode commonly
+ *  creates, and the sprite formats SDL_DisplayFormat(Alpha) commonly gets,
+ *  into the 32-bit formats window surfaces use.  Anything these don't
+ *  cover goes through SDL_BlitSurface or SDL_ConvertSurface as before.
+ */
+typedef struct SDL_PixelKernel SDL_PixelKernel;
+
+typedef void (*SDL_PixelRowFunc) (const SDL_PixelKernel * kernel,
+                                  const Uint8 * src, Uint32 * dst,
+                                  int width, SDL_bool stream);
+
+struct SDL_PixelKernel
+{
+    Uint32 src_format;
+    Uint32 dst_format;
+    SDL_PixelRowFunc func;
+
+    /* 16-bit sources: red shift and green width, 565 or 555 */
+    int rshift16, gbits;
+
+    /* 24 and 32-bit sources: byte offsets of each channel, -1 if absent */
+    int src_bpp, src_r, src_g, src_b, src_a;
+    /* Bit positions of the destination channels */
+    int dst_r, dst_g, dst_b, dst_a;
+    Uint32 fill;                /* Or'ed in where there's no alpha to copy */
+    Uint8 shuffle[16];          /* pshufb mask for four pixels */
+
+    /* 8-bit sources: the destination pixel for each index */
+    const Uint32 *table;
+};
+
+#define COMPAT_CPU_SSE2     0x01
+#define COMPAT_CPU_SSSE3    0x02
+#define COMPAT_CPU_AVX2     0x04
+
+static int SDL_CompatCPUFeatures = 0;
+
+static SDL_PixelKernel SDL_ShadowKernel;
+
+static SDL_INLINE Uint32
+ConvertPixel16(const SDL_PixelKernel * kernel, Uint16 p)
+{
+    Uint32 r, g, b;
+
+    r = (p >> kernel->rshift16) & 0x1f;
+    g = (p >> 5) & ((1 << kernel->gbits) - 1);
+    b = p & 0x1f;
+    r = (r << 3) | (r >> 2);
+    if (kernel->gbits == 6) {
+        g = (g << 2) | (g >> 4);
+    } else {
+        g = (g << 3) | (g >> 2);
+    }
+    b = (b << 3) | (b >> 2);
+    return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+static SDL_INLINE Uint32
+ConvertPixelBytes(const SDL_PixelKernel * kernel, const Uint8 * p)
+{
+    Uint32 pixel = kernel->fill;
+
+    pixel |= (Uint32) p[kernel->src_r] << kernel->dst_r;
+    pixel |= (Uint32) p[kernel->src_g] << kernel->dst_g;
+    pixel |= (Uint32) p[kernel->src_b] << kernel->dst_b;
+    if (!kernel->fill) {
+        pixel |= (Uint32) p[kernel->src_a] << kernel->dst_a;
+    }
+    return pixel;
+}
+
+static void
+ConvertIndex(const SDL_PixelKernel * kernel, const Uint8 * src,
+             Uint32 * dst, int width, SDL_bool stream)
+{
+    int x;
+
+    for (x = 0; x < width; ++x) {
+        dst[x] = kernel->table[src[x]];
+    }
+}
+
+/* Clear the alpha of converted pixels whose colour is the colorkey's */
+static void
+ApplyColorKey(Uint32 * dst, int width, Uint32 key, Uint32 rgbmask,
+              Uint32 amask)
+{
+    int x;
+
+    for (x = 0; x < width; ++x) {
+        if ((dst[x] & rgbmask) == key) {
+            dst[x] &= ~amask;
+        }
+    }
+}
+
+#ifdef HAVE_COMPAT_X86_KERNELS
+
+/* Non-temporal stores need aligned destinations: how many pixels the
+   scalar loop has to do before the vector one can start streaming */
+static SDL_INLINE int
+StreamHead(const Uint32 * dst, int align, int width, SDL_bool stream)
+{
+    int head;
+
+    if (!stream) {
+        return 0;
+    }
+    head = (int) (((align - ((size_t) dst & (align - 1))) & (align - 1)) / 4);
+    return SDL_min(head, width);
+}
+
+__attribute__((target("sse2")))
+static SDL_INLINE __m128i
+Expand16_SSE2(const SDL_PixelKernel * kernel, __m128i p, __m128i * hi)
+{
+    const __m128i five = _mm_set1_epi16(0x1f);
+    const __m128i gmask = _mm_set1_epi16((1 << kernel->gbits) - 1);
+    const __m128i rshift = _mm_cvtsi32_si128(kernel->rshift16);
+    const __m128i gup = _mm_cvtsi32_si128(8 - kernel->gbits);
+    const __m128i gdown = _mm_cvtsi32_si128(2 * kernel->gbits - 8);
+    __m128i r, g, b, bg, ra;
+
+    r = _mm_and_si128(_mm_srl_epi16(p, rshift), five);
+    g = _mm_and_si128(_mm_srli_epi16(p, 5), gmask);
+    b = _mm_and_si128(p, five);
+    r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g = _mm_or_si128(_mm_sll_epi16(g, gup), _mm_srl_epi16(g, gdown));
+    b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+    bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    ra = _mm_or_si128(r, _mm_set1_epi16((short) 0xff00));
+    *hi = _mm_unpackhi_epi16(bg, ra);
+    return _mm_unpacklo_epi16(bg, ra);
+}
+
+__attribute__((target("sse2")))
+static void
+Convert16_SSE2(const SDL_PixelKernel * kernel, const Uint8 * src,
+               Uint32 * dst, int width, SDL_bool stream)
+{
+    const Uint16 *src16 = (const Uint16 *) src;
+    int x = 0;
+    int head = StreamHead(dst, 16, width, stream);
+
+    for (; x < head; ++x) {
+        dst[x] = ConvertPixel16(kernel, src16[x]);
+    }
+    for (; x + 8 <= width; x += 8) {
+        __m128i lo, hi;
+
+        lo = Expand16_SSE2(kernel,
+                           _mm_loadu_si128((const __m128i *) (src16 + x)),
+                           &hi);
+        if (stream) {
+            _mm_stream_si128((__m128i *) (dst + x), lo);
+            _mm_stream_si128((__m128i *) (dst + x + 4), hi);
+        } else {
+            _mm_storeu_si128((__m128i *) (dst + x), lo);
+            _mm_storeu_si128((__m128i *) (dst + x + 4), hi);
+        }
+    }
+    for (; x < width; ++x) {
+        dst[x] = ConvertPixel16(kernel, src16[x]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+Convert16_AVX2(const SDL_PixelKernel * kernel, const Uint8 * src,
+               Uint32 * dst, int width, SDL_bool stream)
+{
+    const Uint16 *src16 = (const Uint16 *) src;
+    const __m256i five = _mm256_set1_epi16(0x1f);
+    const __m256i gmask = _mm256_set1_epi16((1 << kernel->gbits) - 1);
+    const __m128i rshift = _mm_cvtsi32_si128(kernel->rshift16);
+    const __m128i gup = _mm_cvtsi32_si128(8 - kernel->gbits);
+    const __m128i gdown = _mm_cvtsi32_si128(2 * kernel->gbits - 8);
+    int x = 0;
+    int head = StreamHead(dst, 32, width, stream);
+
+    for (; x < head; ++x) {
+        dst[x] = ConvertPixel16(kernel, src16[x]);
+    }
+    for (; x + 16 <= width; x += 16) {
+        __m256i p, r, g, b, bg, ra, lo, hi, out0, out1;
+
+        p = _mm256_loadu_si256((const __m256i *) (src16 + x));
+        r = _mm256_and_si256(_mm256_srl_epi16(p, rshift), five);
+        g = _mm256_and_si256(_mm256_srli_epi16(p, 5), gmask);
+        b = _mm256_and_si256(p, five);
+        r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+        g = _mm256_or_si256(_mm256_sll_epi16(g, gup),
+                            _mm256_srl_epi16(g, gdown));
+        b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+
+        bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+        ra = _mm256_or_si256(r, _mm256_set1_epi16((short) 0xff00));
+        /* The unpacks work per 128-bit lane: lo = {0-3, 8-11}, hi = {4-7, 12-15} */
+        lo = _mm256_unpacklo_epi16(bg, ra);
+        hi = _mm256_unpackhi_epi16(bg, ra);
+        out0 = _mm256_permute2x128_si256(lo, hi, 0x20);
+        out1 = _mm256_permute2x128_si256(lo, hi, 0x31);
+        if (stream) {
+            _mm256_stream_si256((__m256i *) (dst + x), out0);
+            _mm256_stream_si256((__m256i *) (dst + x + 8), out1);
+        } else {
+            _mm256_storeu_si256((__m256i *) (dst + x), out0);
+            _mm256_storeu_si256((__m256i *) (dst + x + 8), out1);
+        }
+    }
+    for (; x < width; ++x) {
+        dst[x] = ConvertPixel16(kernel, src16[x]);
+    }
+}
+
+/* 24 and 32-bit sources: one pshufb per four pixels.
+ * The 24-bit loops stop early, each load reads 16 bytes for 12 used.
+ */
+__attribute__((target("ssse3")))
+static void
+ConvertBytes_SSSE3(const SDL_PixelKernel * kernel, const Uint8 * src,
+                   Uint32 * dst, int width, SDL_bool stream)
+{
+    const __m128i shuffle =
+        _mm_loadu_si128((const __m128i *) kernel->shuffle);
+    const __m128i fill = _mm_set1_epi32(kernel->fill);
+    const int bpp = kernel->src_bpp;
+    const int end = (bpp == 3) ? width - 2 : width;
+    int x = 0;
+    int head = StreamHead(dst, 16, width, stream);
+
+    for (; x < head; ++x) {
+        dst[x] = ConvertPixelBytes(kernel, src + x * bpp);
+    }
+    for (; x + 4 <= end; x += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i *) (src + x * bpp));
+
+        p = _mm_or_si128(_mm_shuffle_epi8(p, shuffle), fill);
+        if (stream) {
+            _mm_stream_si128((__m128i *) (dst + x), p);
+        } else {
+            _mm_storeu_si128((__m128i *) (dst + x), p);
+        }
+    }
+    for (; x < width; ++x) {
+        dst[x] = ConvertPixelBytes(kernel, src + x * bpp);
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+ConvertBytes_AVX2(const SDL_PixelKernel * kernel, const Uint8 * src,
+                  Uint32 * dst, int width, SDL_bool stream)
+{
+    const __m128i shuffle128 =
+        _mm_loadu_si128((const __m128i *) kernel->shuffle);
+    const __m256i shuffle = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(shuffle128), shuffle128, 1);
+    const __m256i fill = _mm256_set1_epi32(kernel->fill);
+    const int bpp = kernel->src_bpp;
+    const int end = (bpp == 3) ? width - 2 : width;
+    int x = 0;
+    int head = StreamHead(dst, 32, width, stream);
+
+    for (; x < head; ++x) {
+        dst[x] = ConvertPixelBytes(kernel, src + x * bpp);
+    }
+    for (; x + 8 <= end; x += 8) {
+        const Uint8 *p = src + x * bpp;
+        __m256i v;
+
+        /* Four pixels per 128-bit lane, pshufb can't cross lanes */
+        v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                _mm_loadu_si128((const __m128i *) p)),
+                _mm_loadu_si128((const __m128i *) (p + 4 * bpp)), 1);
+        v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), fill);
+        if (stream) {
+            _mm256_stream_si256((__m256i *) (dst + x), v);
+        } else {
+            _mm256_storeu_si256((__m256i *) (dst + x), v);
+        }
+    }
+    for (; x < width; ++x) {
+        dst[x] = ConvertPixelBytes(kernel, src + x * bpp);
+    }
+}
+
+/* 8-bit sources: the palette lookup as a gather, eight pixels at a time */
+__attribute__((target("avx2")))
+static void
+ConvertIndex_AVX2(const SDL_PixelKernel * kernel, const Uint8 * src,
+                  Uint32 * dst, int width, SDL_bool stream)
+{
+    const int *table = (const int *) kernel->table;
+    int x = 0;
+    int head = StreamHead(dst, 32, width, stream);
+
+    for (; x < head; ++x) {
+        dst[x] = kernel->table[src[x]];
+    }
+    for (; x + 8 <= width; x += 8) {
+        __m256i index, v;
+
+        index = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i *) (src + x)));
+        v = _mm256_i32gather_epi32(table, index, 4);
+        if (stream) {
+            _mm256_stream_si256((__m256i *) (dst + x), v);
+        } else {
+            _mm256_storeu_si256((__m256i *) (dst + x), v);
+        }
+    }
+    for (; x < width; ++x) {
+        dst[x] = kernel->table[src[x]];
+    }
+}
+
+__attribute__((target("sse2")))
+static void
+ApplyColorKey_SSE2(Uint32 * dst, int width, Uint32 key, Uint32 rgbmask,
+                   Uint32 amask)
+{
+    const __m128i vkey = _mm_set1_epi32(key);
+    const __m128i vrgb = _mm_set1_epi32(rgbmask);
+    const __m128i valpha = _mm_set1_epi32(amask);
+    int x;
+
+    for (x = 0; x + 4 <= width; x += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i *) (dst + x));
+        __m128i hit = _mm_cmpeq_epi32(_mm_and_si128(p, vrgb), vkey);
+
+        p = _mm_andnot_si128(_mm_and_si128(hit, valpha), p);
+        _mm_storeu_si128((__m128i *) (dst + x), p);
+    }
+    ApplyColorKey(dst + x, width - x, key, rgbmask, amask);
+}
+
+__attribute__((target("sse2")))
+static void
+StreamFence_SSE2(void)
+{
+    _mm_sfence();
+}
+
+#endif /* HAVE_COMPAT_X86_KERNELS */
+
+static void
+SDL_InitCPUFeatures(void)
+{
+#ifdef HAVE_COMPAT_X86_KERNELS
+    if (SDL_HasSSE2()) {
+        SDL_CompatCPUFeatures |= COMPAT_CPU_SSE2;
+    }
+    /* SDL 2.0 doesn't report SSSE3 */
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        SDL_CompatCPUFeatures |= COMPAT_CPU_SSSE3;
+    }
+    if (SDL_HasAVX2()) {
+        SDL_CompatCPUFeatures |= COMPAT_CPU_AVX2;
+    }
+#endif
+}
+
+/* Byte offset of an 8-bit channel in a little endian pixel, or -1 */
+static int
+GetChannelByte(Uint32 mask)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        if (mask == (Uint32) 0xff << (i * 8)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Pick a kernel converting src to dst, if there is one for this CPU */
+static SDL_bool
+SDL_ChoosePixelKernel(SDL_PixelKernel * kernel, const SDL_PixelFormat * src,
+                      const SDL_PixelFormat * dst)
+{
+    int i, dst_bytes[4];
+
+    SDL_zerop(kernel);
+    kernel->src_format = src->format;
+    kernel->dst_format = dst->format;
+
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN && defined(HAVE_COMPAT_X86_KERNELS)
+    if (dst->BytesPerPixel != 4 || src->palette) {
+        return SDL_FALSE;
+    }
+
+    dst_bytes[0] = GetChannelByte(dst->Rmask);
+    dst_bytes[1] = GetChannelByte(dst->Gmask);
+    dst_bytes[2] = GetChannelByte(dst->Bmask);
+    if (dst_bytes[0] < 0 || dst_bytes[1] < 0 || dst_bytes[2] < 0) {
+        return SDL_FALSE;
+    }
+    /* The byte left over is alpha, or padding we fill with 0xff */
+    dst_bytes[3] = 6 - dst_bytes[0] - dst_bytes[1] - dst_bytes[2];
+    kernel->dst_r = dst_bytes[0] * 8;
+    kernel->dst_g = dst_bytes[1] * 8;
+    kernel->dst_b = dst_bytes[2] * 8;
+    kernel->dst_a = dst_bytes[3] * 8;
+
+    if (src->BytesPerPixel == 2) {
+        /* The 16-bit kernels only write XRGB/ARGB */
+        if (dst_bytes[0] != 2 || dst_bytes[1] != 1 || dst_bytes[2] != 0) {
+            return SDL_FALSE;
+        }
+        if (src->Rmask == 0xf800 && src->Gmask == 0x07e0 &&
+            src->Bmask == 0x001f) {
+            kernel->rshift16 = 11;
+            kernel->gbits = 6;
+        } else if (src->Rmask == 0x7c00 && src->Gmask == 0x03e0 &&
+                   src->Bmask == 0x001f) {
+            kernel->rshift16 = 10;
+            kernel->gbits = 5;
+        } else {
+            return SDL_FALSE;
+        }
+        if (SDL_CompatCPUFeatures & COMPAT_CPU_AVX2) {
+            kernel->func = Convert16_AVX2;
+        } else if (SDL_CompatCPUFeatures & COMPAT_CPU_SSE2) {
+            kernel->func = Convert16_SSE2;
+        }
+        return kernel->func ? SDL_TRUE : SDL_FALSE;
+    }
+
+    if (src->BytesPerPixel != 3 && src->BytesPerPixel != 4) {
+        return SDL_FALSE;
+    }
+    kernel->src_bpp = src->BytesPerPixel;
+    kernel->src_r = GetChannelByte(src->Rmask);
+    kernel->src_g = GetChannelByte(src->Gmask);
+    kernel->src_b = GetChannelByte(src->Bmask);
+    kernel->src_a = src->Amask ? GetChannelByte(src->Amask) : -1;
+    if (kernel->src_r < 0 || kernel->src_g < 0 || kernel->src_b < 0 ||
+        (src->Amask && kernel->src_a < 0)) {
+        return SDL_FALSE;
+    }
+    if (kernel->src_a < 0 || !dst->Amask) {
+        kernel->fill = (Uint32) 0xff << kernel->dst_a;
+    }
+
+    for (i = 0; i < 16; ++i) {
+        int pixel = i / 4, byte = i % 4, offset;
+
+        if (byte == dst_bytes[0]) {
+            offset = kernel->src_r;
+        } else if (byte == dst_bytes[1]) {
+            offset = kernel->src_g;
+        } else if (byte == dst_bytes[2]) {
+            offset = kernel->src_b;
+        } else if (!kernel->fill) {
+            offset = kernel->src_a;
+        } else {
+            kernel->shuffle[i] = 0x80;  /* pshufb zeroes this byte */
+            continue;
+        }
+        kernel->shuffle[i] = pixel * kernel->src_bpp + offset;
+    }
+
+    if (SDL_CompatCPUFeatures & COMPAT_CPU_AVX2) {
+        kernel->func = ConvertBytes_AVX2;
+    } else if (SDL_CompatCPUFeatures & COMPAT_CPU_SSSE3) {
+        kernel->func = ConvertBytes_SSSE3;
+    }
+#endif
+    return kernel->func ? SDL_TRUE : SDL_FALSE;
+}
+
+static void
+SDL_ConvertPixelRect(const SDL_PixelKernel * kernel,
+                     SDL_Surface * src, SDL_Surface * dst,
+                     const SDL_Rect * rect, SDL_bool stream)
+{
+    const Uint8 *srcrow;
+    Uint8 *dstrow;
+    int row;
+
+    srcrow = (const Uint8 *) src->pixels + rect->y * src->pitch +
+        rect->x * src->format->BytesPerPixel;
+    dstrow = (Uint8 *) dst->pixels + rect->y * dst->pitch + rect->x * 4;
+    for (row = 0; row < rect->h; ++row) {
+        kernel->func(kernel, srcrow, (Uint32 *) dstrow, rect->w, stream);
+        srcrow += src->pitch;
+        dstrow += dst->pitch;
+    }
+#ifdef HAVE_COMPAT_X86_KERNELS
+    if (stream) {
+        StreamFence_SSE2();
+    }
+#endif
+}
+
+/* Pick a kernel expanding a palettized surface through table */
+static SDL_bool
+SDL_ChooseIndexKernel(SDL_PixelKernel * kernel, const SDL_PixelFormat * src,
+                      const SDL_PixelFormat * dst, Uint32 * table)
+{
+    const SDL_Color *color;
+    int i;
+
+    SDL_zerop(kernel);
+    kernel->src_format = src->format;
+    kernel->dst_format = dst->format;
+    if (src->BitsPerPixel != 8 || !src->palette || dst->BytesPerPixel != 4) {
+        return SDL_FALSE;
+    }
+
+    for (i = 0; i < 256; ++i) {
+        if (i < src->palette->ncolors) {
+            color = &src->palette->colors[i];
+            table[i] = SDL_MapRGB(dst, color->r, color->g, color->b);
+        } else {
+            table[i] = SDL_MapRGB(dst, 0, 0, 0);
+        }
+    }
+    kernel->table = table;
+    kernel->func = ConvertIndex;
+#ifdef HAVE_COMPAT_X86_KERNELS
+    if (SDL_CompatCPUFeatures & COMPAT_CPU_AVX2) {
+        kernel->func = ConvertIndex_AVX2;
+    }
+#endif
+    return SDL_TRUE;
+}
+
+/* SDL_ConvertSurface() for the formats the kernels cover, into 32-bit
+ *  formats.  A colorkey becomes transparent alpha when there's alpha,
+ *  as SDL 1.2 does it, by index for palettized surfaces.  Returns NULL
+ *  if it can't, for the caller to try SDL_ConvertSurface().
+ */
+static SDL_Surface *
+SDL_ConvertSurfaceFast(SDL_Surface * surface, SDL_PixelFormat * format)
+{
+    SDL_PixelKernel kernel;
+    Uint32 table[256];
+    SDL_Surface *converted;
+    SDL_Rect rect;
+    SDL_bool colorkey;
+    Uint32 key, src_key, rgbmask;
+    Uint8 r, g, b, a;
+    Uint8 *row;
+    int index, y;
+
+    if (!surface || !format || format->BytesPerPixel != 4) {
+        return NULL;
+    }
+    /* Modulation changes the colours the slow way writes */
+    SDL_GetSurfaceColorMod(surface, &r, &g, &b);
+    SDL_GetSurfaceAlphaMod(surface, &a);
+    if ((r & g & b & a) != 0xff) {
+        return NULL;
+    }
+    if (surface->format->palette) {
+        if (!SDL_ChooseIndexKernel(&kernel, surface->format, format, table)) {
+            return NULL;
+        }
+    } else if (!SDL_ChoosePixelKernel(&kernel, surface->format, format)) {
+        return NULL;
+    }
+
+    converted = SDL_CreateRGBSurface(0, surface->w, surface->h, 32,
+                                     format->Rmask, format->Gmask,
+                                     format->Bmask, format->Amask);
+    if (!converted) {
+        return NULL;
+    }
+
+    /* The key in the destination format, by converting it as a pixel */
+    colorkey = (SDL_GetColorKey(surface, &key) == 0);
+    if (colorkey && kernel.table) {
+        index = key & 0xff;
+        key = table[index];
+        if (format->Amask) {
+            table[index] &= ~format->Amask;
+        }
+    } else if (colorkey) {
+        src_key = key;
+        kernel.func(&kernel, (const Uint8 *) &src_key, &key, 1, SDL_FALSE);
+    }
+
+    if (SDL_MUSTLOCK(surface)) {
+        SDL_LockSurface(surface);
+    }
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = surface->w;
+    rect.h = surface->h;
+    SDL_ConvertPixelRect(&kernel, surface, converted, &rect, SDL_FALSE);
+    if (SDL_MUSTLOCK(surface)) {
+        SDL_UnlockSurface(surface);
+    }
+
+    /* Palettized surfaces had it done through the table */
+    if (colorkey && format->Amask && !kernel.table) {
+        rgbmask = format->Rmask | format->Gmask | format->Bmask;
+        row = (Uint8 *) converted->pixels;
+        for (y = 0; y < converted->h; ++y) {
+#ifdef HAVE_COMPAT_X86_KERNELS
+            if (SDL_CompatCPUFeatures & COMPAT_CPU_SSE2) {
+                ApplyColorKey_SSE2((Uint32 *) row, converted->w,
+                                   key & rgbmask, rgbmask, format->Amask);
+            } else
+#endif
+            {
+                ApplyColorKey((Uint32 *) row, converted->w,
+                              key & rgbmask, rgbmask, format->Amask);
+            }
+            row += converted->pitch;
+        }
+    } else if (colorkey && !format->Amask) {
+        SDL_SetColorKey(converted, SDL_TRUE, key);
+    }
+
+    /* Match SDL_ConvertSurface(): new surfaces with alpha default to
+       blending, which it only keeps if there's alpha to blend */
+    if (format->Amask && (surface->format->Amask || colorkey)) {
+        SDL_SetSurfaceBlendMode(converted, SDL_BLENDMODE_BLEND);
+    } else {
+        SDL_SetSurfaceBlendMode(converted, SDL_BLENDMODE_NONE);
+    }
+    SDL_SetClipRect(converted, &surface->clip_rect);
+    return converted;
+}
+
+/* Rectangles smaller than this aren't worth handing to the workers */
+#define COMPAT_BAND_MIN_PIXELS  (256 * 256)
+#define COMPAT_BAND_MIN_ROWS    16
+
+typedef struct
+{
+    SDL_Surface *shadow;
+    SDL_Rect rect;              /* The whole rectangle being split up */
+    int rows;                   /* Rows per band */
+    SDL_bool stream;
+} SDL_ShadowBands;
+
+static void
+SDL_ConvertShadowBand(void *data, int band)
+{
+    const SDL_ShadowBands *bands = (const SDL_ShadowBands *) data;
+    SDL_Rect rect = bands->rect;
+    COMPAT_TRACE("SDL_ConvertShadowBand");
+
+    rect.y += band * bands->rows;
+    rect.h = SDL_min(bands->rows, bands->rect.y + bands->rect.h - rect.y);
+
+    if (SDL_ShadowKernel.func) {
+        SDL_ConvertPixelRect(&SDL_ShadowKernel, bands->shadow,
+                             SDL_VideoSurface, &rect, bands->stream);
+    } else {
+        /* Unlike SDL_BlitSurface, this keeps no state in the surfaces */
+        SDL_ConvertPixels(rect.w, rect.h, bands->shadow->format->format,
+                          (Uint8 *) bands->shadow->pixels +
+                          rect.y * bands->shadow->pitch +
+                          rect.x * bands->shadow->format->BytesPerPixel,
+                          bands->shadow->pitch,
+                          SDL_VideoSurface->format->format,
+                          (Uint8 *) SDL_VideoSurface->pixels +
+                          rect.y * SDL_VideoSurface->pitch +
+                          rect.x * SDL_VideoSurface->format->BytesPerPixel,
+                          SDL_VideoSurface->pitch);
+    }
+}
+
+/* Shadow surface to video surface, the heart of shadowed SDL_UpdateRects */
+static void
+SDL_ConvertShadowRects(SDL_Surface * shadow, int numrects,
+                       const SDL_Rect * rects)
+{
+    SDL_bool plain, stream;
+    int i;
+
+    if (SDL_ShadowKernel.src_format != shadow->format->format ||
+        SDL_ShadowKernel.dst_format != SDL_VideoSurface->format->format) {
+        SDL_ChoosePixelKernel(&SDL_ShadowKernel, shadow->format,
+                              SDL_VideoSurface->format);
+    }
+
+    /* Kernels and the workers just copy, anything fancier the application
+       set up on the screen surface needs a real blit */
+    plain = !SDL_MUSTLOCK(shadow) &&
+        !(shadow->map->info.flags & SDL_COPY_MODIFIERS);
+
+    /* A whole frame won't be read back soon, keep it out of the cache */
+    stream = (numrects == 1 && rects[0].w == shadow->w &&
+              rects[0].h == shadow->h);
+
+    for (i = 0; i < numrects; ++i) {
+        const SDL_Rect *rect = &rects[i];
+
+        COMPAT_METRIC_ADD(convert_bytes, rect->w * rect->h *
+                          SDL_VideoSurface->format->BytesPerPixel);
+
+        if (plain && SDL_Workers.numthreads &&
+            !shadow->format->palette &&
+            rect->w * rect->h >= COMPAT_BAND_MIN_PIXELS) {
+            SDL_ShadowBands bands;
+            int count = SDL_Workers.numthreads + 1;
+
+            bands.shadow = shadow;
+            bands.rect = *rect;
+            bands.rows = SDL_max((rect->h + count - 1) / count,
+                                 COMPAT_BAND_MIN_ROWS);
+            bands.stream = stream;
+            SDL_RunJobs(SDL_ConvertShadowBand, &bands,
+                        (rect->h + bands.rows - 1) / bands.rows);
+        } else if (plain && SDL_ShadowKernel.func) {
+            SDL_ConvertPixelRect(&SDL_ShadowKernel, shadow, SDL_VideoSurface,
+                                 rect, stream);
+        } else {
+            SDL_Rect dstrect = *rect;
+
+            SDL_BlitSurface(shadow, (SDL_Rect *) rect,
+                            SDL_VideoSurface, &dstrect);
+        }
+    }
+}
+
+/* Merge b into a, if they touch and the union costs no more than both */
+static SDL_bool
+MergeUpdateRect(SDL_Rect * a, const SDL_Rect * b)
+{
+    SDL_Rect merged;
+
+    if (b->x > a->x + a->w || a->x > b->x + b->w ||
+        b->y > a->y + a->h || a->y > b->y + b->h) {
+        return SDL_FALSE;
+    }
+    SDL_UnionRect(a, b, &merged);
+    if ((Sint64) merged.w * merged.h >
+        (Sint64) a->w * a->h + (Sint64) b->w * b->h) {
+        return SDL_FALSE;
+    }
+    *a = merged;
+    return SDL_TRUE;
+}
+
+/* Clip the rectangles to the screen and merge overlapping and adjacent
+ *  ones into the update buffer, or replace them all with the whole screen
+ *  once enough of it is dirty.  Returns the number of rectangles left.
+ */
+static int
+CoalesceUpdateRects(SDL_Surface * screen, int numrects, const SDL_Rect * rects,
+                    SDL_Rect ** result)
+{
+    static SDL_Rect everything;
+    SDL_Rect bounds;
+    SDL_Rect *out;
+    Sint64 covered;
+    int i, j, n, merged;
+
+    bounds.x = 0;
+    bounds.y = 0;
+    bounds.w = screen->w;
+    bounds.h = screen->h;
+
+    if (numrects > SDL_UpdateRectsBufferSize) {
+        int size = SDL_max(numrects, 2 * SDL_UpdateRectsBufferSize);
+
+        out = (SDL_Rect *) SDL_realloc(SDL_UpdateRectsBuffer,
+                                       size * sizeof(*out));
+        if (!out) {
+            /* No room to sort them out, just update everything */
+            everything = bounds;
+            *result = &everything;
+            return 1;
+        }
+        SDL_UpdateRectsBuffer = out;
+        SDL_UpdateRectsBufferSize = size;
+    }
+    out = SDL_UpdateRectsBuffer;
+
+    n = 0;
+    for (i = 0; i < numrects; ++i) {
+        SDL_Rect rect;
+
+        if (!SDL_IntersectRect(&rects[i], &bounds, &rect)) {
+            continue;
+        }
+        for (j = 0; j < n; ++j) {
+            if (MergeUpdateRect(&out[j], &rect)) {
+                break;
+            }
+        }
+        if (j == n) {
+            out[n++] = rect;
+        }
+    }
+
+    /* Growing a rectangle can make it touch ones it didn't before */
+    do {
+        merged = 0;
+        for (i = 0; i < n; ++i) {
+            for (j = i + 1; j < n;) {
+                if (MergeUpdateRect(&out[i], &out[j])) {
+                    out[j] = out[--n];
+                    merged = 1;
+                } else {
+                    ++j;
+                }
+            }
+        }
+    } while (merged);
+
+    covered = 0;
+    for (i = 0; i < n; ++i) {
+        covered += (Sint64) out[i].w * out[i].h;
+    }
+    if (n > 1 && covered * 100 >=
+        (Sint64) bounds.w * bounds.h * SDL_UpdateCoverage) {
+        out[0] = bounds;
+        n = 1;
+    }
+
+    *result = out;
+    return n;
+}
+
+/* === Scaling === */
+
+/* With SDL_COMPAT_SCALE, fullscreen window surface modes give the video
+ *  surface pixels of its own, and rectangles are scaled from it into the
+ *  window surface as they're presented.  32-bit pixels only, which is what
+ *  desktops use.  The source column and row of every destination column and
+ *  row are worked out once per size, in 16.16 fixed point for linear.
+ */
+typedef struct
+{
+    int mode;
+    int src_w, src_h;
+    int dst_w, dst_h;
+    Uint32 *xmap;
+    Uint32 *ymap;
+    Uint32 *row;                /* Linear: two rows blended, one pixel spare */
+} SDL_VideoScaler;
+
+static SDL_VideoScaler SDL_Scaler;
+
+/* Video is going away, the scaled video surface's pixels with it */
+static void
+StopVideoScaling(void)
+{
+    if (SDL_VideoScale && SDL_VideoSurface) {
+        SDL_free(SDL_VideoSurface->pixels);
+        SDL_VideoSurface->pixels = NULL;
+    }
+    SDL_VideoScale = COMPAT_SCALE_NONE;
+
+    SDL_free(SDL_Scaler.xmap);
+    SDL_free(SDL_Scaler.ymap);
+    SDL_free(SDL_Scaler.row);
+    SDL_zero(SDL_Scaler);
+}
+
+static Uint32
+GetScaleMapping(int mode, int dst, int src_size, int dst_size)
+{
+    Sint64 pos;
+
+    if (mode != COMPAT_SCALE_LINEAR) {
+        return (Uint32) ((Sint64) dst * src_size / dst_size);
+    }
+    /* Where the centre of the destination pixel falls in the source */
+    pos = (((Sint64) (2 * dst + 1) * src_size) << 16) / (2 * dst_size) - 0x8000;
+    pos = SDL_max(pos, 0);
+    pos = SDL_min(pos, (Sint64) (src_size - 1) << 16);
+    return (Uint32) pos;
+}
+
+static SDL_bool
+SetupVideoScaler(void)
+{
+    SDL_VideoScaler *scaler = &SDL_Scaler;
+    Uint32 *xmap, *ymap, *row;
+    int i;
+
+    if (scaler->mode == SDL_VideoScale &&
+        scaler->src_w == SDL_VideoSurface->w &&
+        scaler->src_h == SDL_VideoSurface->h &&
+        scaler->dst_w == SDL_VideoViewport.w &&
+        scaler->dst_h == SDL_VideoViewport.h) {
+        return SDL_TRUE;
+    }
+    if (SDL_VideoViewport.w <= 0 || SDL_VideoViewport.h <= 0) {
+        return SDL_FALSE;
+    }
+
+    xmap = (Uint32 *) SDL_realloc(scaler->xmap,
+                                  SDL_VideoViewport.w * sizeof(Uint32));
+    if (xmap) {
+        scaler->xmap = xmap;
+    }
+    ymap = (Uint32 *) SDL_realloc(scaler->ymap,
+                                  SDL_VideoViewport.h * sizeof(Uint32));
+    if (ymap) {
+        scaler->ymap = ymap;
+    }
+    row = (Uint32 *) SDL_realloc(scaler->row,
+                                 (SDL_VideoSurface->w + 1) * sizeof(Uint32));
+    if (row) {
+        scaler->row = row;
+    }
+    if (!xmap || !ymap || !row) {
+        scaler->mode = COMPAT_SCALE_NONE;
+        SDL_OutOfMemory();
+        return SDL_FALSE;
+    }
+
+    scaler->mode = SDL_VideoScale;
+    scaler->src_w = SDL_VideoSurface->w;
+    scaler->src_h = SDL_VideoSurface->h;
+    scaler->dst_w = SDL_VideoViewport.w;
+    scaler->dst_h = SDL_VideoViewport.h;
+    for (i = 0; i < scaler->dst_w; ++i) {
+        xmap[i] = GetScaleMapping(scaler->mode, i, scaler->src_w, scaler->dst_w);
+    }
+    for (i = 0; i < scaler->dst_h; ++i) {
+        ymap[i] = GetScaleMapping(scaler->mode, i, scaler->src_h, scaler->dst_h);
+    }
+    return SDL_TRUE;
+}
+
+static void
+ScaleRowNearest(const Uint32 * src, Uint32 * dst, const Uint32 * xmap,
+                int width)
+{
+    int x;
+
+    for (x = 0; x < width; ++x) {
+        dst[x] = src[xmap[x]];
+    }
+}
+
+/* (a * (256 - f) + b * f) / 256 for each channel */
+static SDL_INLINE Uint32
+BlendPixels(Uint32 a, Uint32 b, Uint32 f)
+{
+    Uint32 rb, ag;
+
+    rb = (((a & 0x00FF00FF) * (256 - f) + (b & 0x00FF00FF) * f) >> 8) & 0x00FF00FF;
+    ag = (((a >> 8) & 0x00FF00FF) * (256 - f) +
+          ((b >> 8) & 0x00FF00FF) * f) & 0xFF00FF00;
+    return rb | ag;
+}
+
+static void
+BlendRows(const Uint32 * a, const Uint32 * b, Uint32 * dst, Uint32 f,
+          int width)
+{
+    int x;
+
+    for (x = 0; x < width; ++x) {
+        dst[x] = BlendPixels(a[x], b[x], f);
+    }
+}
+
+static void
+ScaleRowLinear(const Uint32 * row, Uint32 * dst, const Uint32 * xmap,
+               int width)
+{
+    int x;
+
+    for (x = 0; x < width; ++x) {
+        Uint32 pos = xmap[x];
+        dst[x] = BlendPixels(row[pos >> 16], row[(pos >> 16) + 1],
+                             (pos >> 8) & 0xFF);
+    }
+}
+
+#ifdef HAVE_COMPAT_X86_KERNELS
+
+__attribute__((target("avx2")))
+static void
+ScaleRowNearest_AVX2(const Uint32 * src, Uint32 * dst, const Uint32 * xmap,
+                     int width)
+{
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m256i index = _mm256_loadu_si256((const __m256i *) (xmap + x));
+        _mm256_storeu_si256((__m256i *) (dst + x),
+            _mm256_i32gather_epi32((const int *) src, index, 4));
+    }
+    ScaleRowNearest(src, dst + x, xmap + x, width - x);
+}
+
+/* Whole multiples only repeat pixels, no lookups needed */
+__attribute__((target("sse2")))
+static void
+ScaleRowDouble_SSE2(const Uint32 * src, Uint32 * dst, int width)
+{
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i *) (src + x / 2));
+        _mm_storeu_si128((__m128i *) (dst + x), _mm_unpacklo_epi32(p, p));
+        _mm_storeu_si128((__m128i *) (dst + x + 4), _mm_unpackhi_epi32(p, p));
+    }
+    for (; x < width; ++x) {
+        dst[x] = src[x / 2];
+    }
+}
+
+__attribute__((target("sse2")))
+static void
+ScaleRowQuadruple_SSE2(const Uint32 * src, Uint32 * dst, int width)
+{
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i p = _mm_loadu_si128((const __m128i *) (src + x / 4));
+        _mm_storeu_si128((__m128i *) (dst + x), _mm_shuffle_epi32(p, 0x00));
+        _mm_storeu_si128((__m128i *) (dst + x + 4), _mm_shuffle_epi32(p, 0x55));
+        _mm_storeu_si128((__m128i *) (dst + x + 8), _mm_shuffle_epi32(p, 0xAA));
+        _mm_storeu_si128((__m128i *) (dst + x + 12), _mm_shuffle_epi32(p, 0xFF));
+    }
+    for (; x < width; ++x) {
+        dst[x] = src[x / 4];
+    }
+}
+
+/* Channels widened to 16 bits, where a * (256 - f) + b * f can't overflow */
+__attribute__((target("sse2")))
+static void
+BlendRows_SSE2(const Uint32 * a, const Uint32 * b, Uint32 * dst, Uint32 f,
+               int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wa = _mm_set1_epi16((short) (256 - f));
+    const __m128i wb = _mm_set1_epi16((short) f);
+    int x;
+
+    for (x = 0; x + 4 <= width; x += 4) {
+        __m128i pa = _mm_loadu_si128((const __m128i *) (a + x));
+        __m128i pb = _mm_loadu_si128((const __m128i *) (b + x));
+        __m128i lo, hi;
+
+        lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pa, zero), wa),
+                           _mm_mullo_epi16(_mm_unpacklo_epi8(pb, zero), wb));
+        hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pa, zero), wa),
+                           _mm_mullo_epi16(_mm_unpackhi_epi8(pb, zero), wb));
+        lo = _mm_srli_epi16(lo, 8);
+        hi = _mm_srli_epi16(hi, 8);
+        _mm_storeu_si128((__m128i *) (dst + x), _mm_packus_epi16(lo, hi));
+    }
+    BlendRows(a + x, b + x, dst + x, f, width - x);
+}
+
+/* Two destination pixels at a time, each from a pair of source pixels */
+__attribute__((target("sse2")))
+static void
+ScaleRowLinear_SSE2(const Uint32 * row, Uint32 * dst, const Uint32 * xmap,
+                    int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x;
+
+    for (x = 0; x + 2 <= width; x += 2) {
+        Uint32 pos0 = xmap[x], pos1 = xmap[x + 1];
+        short f0 = (short) ((pos0 >> 8) & 0xFF);
+        short f1 = (short) ((pos1 >> 8) & 0xFF);
+        __m128i p0, p1, w0, w1;
+
+        p0 = _mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i *) (row + (pos0 >> 16))), zero);
+        p1 = _mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i *) (row + (pos1 >> 16))), zero);
+        w0 = _mm_set_epi16(f0, f0, f0, f0, 256 - f0, 256 - f0, 256 - f0, 256 - f0);
+        w1 = _mm_set_epi16(f1, f1, f1, f1, 256 - f1, 256 - f1, 256 - f1, 256 - f1);
+        p0 = _mm_mullo_epi16(p0, w0);
+        p1 = _mm_mullo_epi16(p1, w1);
+        p0 = _mm_add_epi16(p0, _mm_srli_si128(p0, 8));
+        p1 = _mm_add_epi16(p1, _mm_srli_si128(p1, 8));
+        p0 = _mm_srli_epi16(_mm_unpacklo_epi64(p0, p1), 8);
+        _mm_storel_epi64((__m128i *) (dst + x), _mm_packus_epi16(p0, p0));
+    }
+    ScaleRowLinear(row, dst + x, xmap + x, width - x);
+}
+
+#endif /* HAVE_COMPAT_X86_KERNELS */
+
+/* Destination columns dx to dx + width of a row, from source row src */
+static void
+ScaleNearestRow(const Uint32 * src, Uint32 * dst, int dx, int width)
+{
+    const SDL_VideoScaler *scaler = &SDL_Scaler;
+    const Uint32 *xmap = scaler->xmap + dx;
+
+#ifdef HAVE_COMPAT_X86_KERNELS
+    if (scaler->mode == COMPAT_SCALE_INTEGER &&
+        (SDL_CompatCPUFeatures & COMPAT_CPU_SSE2)) {
+        if (scaler->dst_w == scaler->src_w * 2) {
+            ScaleRowDouble_SSE2(src + xmap[0], dst, width);
+            return;
+        }
+        if (scaler->dst_w == scaler->src_w * 4) {
+            ScaleRowQuadruple_SSE2(src + xmap[0], dst, width);
+            return;
+        }
+    }
+    if (SDL_CompatCPUFeatures & COMPAT_CPU_AVX2) {
+        ScaleRowNearest_AVX2(src, dst, xmap, width);
+        return;
+    }
+#endif
+    ScaleRowNearest(src, dst, xmap, width);
+}
+
+/* The same, blending source row pos >> 16 with the one below it */
+static void
+ScaleLinearRow(const Uint8 * src, int pitch, Uint32 pos, Uint32 * dst,
+               int dx, int width)
+{
+    const SDL_VideoScaler *scaler = &SDL_Scaler;
+    const Uint32 *xmap = scaler->xmap + dx;
+    const Uint32 *a, *b;
+    int y = pos >> 16;
+    int lo = xmap[0] >> 16;
+    int hi = SDL_min((xmap[width - 1] >> 16) + 1, scaler->src_w - 1);
+
+    a = (const Uint32 *) (src + y * pitch);
+    b = (const Uint32 *) (src + SDL_min(y + 1, scaler->src_h - 1) * pitch);
+#ifdef HAVE_COMPAT_X86_KERNELS
+    if (SDL_CompatCPUFeatures & COMPAT_CPU_SSE2) {
+        BlendRows_SSE2(a + lo, b + lo, scaler->row + lo, (pos >> 8) & 0xFF,
+                       hi - lo + 1);
+    } else
+#endif
+    {
+        BlendRows(a + lo, b + lo, scaler->row + lo, (pos >> 8) & 0xFF,
+                  hi - lo + 1);
+    }
+    /* The last column blends with nothing, but still reads its neighbour */
+    scaler->row[hi + 1] = scaler->row[hi];
+
+#ifdef HAVE_COMPAT_X86_KERNELS
+    if (SDL_CompatCPUFeatures & COMPAT_CPU_SSE2) {
+        ScaleRowLinear_SSE2(scaler->row, dst, xmap, width);
+        return;
+    }
+#endif
+    ScaleRowLinear(scaler->row, dst, xmap, width);
+}
+
+/* Scale a rectangle of the video surface into the window surface, and
+ *  turn it into the rectangle of the window that changed.
+ */
+static void
+ScaleVideoRect(SDL_Rect * rect)
+{
+    const SDL_VideoScaler *scaler = &SDL_Scaler;
+    const Uint8 *src = (const Uint8 *) SDL_VideoSurface->pixels;
+    int src_pitch = SDL_VideoSurface->pitch;
+    int dst_pitch = SDL_WindowSurface->pitch;
+    int x0 = rect->x, x1 = rect->x + rect->w;
+    int y0 = rect->y, y1 = rect->y + rect->h;
+    int dx0, dx1, dy0, dy1, dy, width;
+    Uint32 pos, last = 0xFFFFFFFF;
+    Uint32 *out, *prev = NULL;
+    Uint8 *dst;
+
+    /* Blended destination pixels depend on the source pixels around them */
+    if (scaler->mode == COMPAT_SCALE_LINEAR) {
+        x0 = SDL_max(x0 - 2, 0);
+        y0 = SDL_max(y0 - 2, 0);
+        x1 = SDL_min(x1 + 2, scaler->src_w);
+        y1 = SDL_min(y1 + 2, scaler->src_h);
+    }
+    dx0 = (int) ((Sint64) x0 * scaler->dst_w / scaler->src_w);
+    dy0 = (int) ((Sint64) y0 * scaler->dst_h / scaler->src_h);
+    dx1 = (int) (((Sint64) x1 * scaler->dst_w + scaler->src_w - 1) /
+                 scaler->src_w);
+    dy1 = (int) (((Sint64) y1 * scaler->dst_h + scaler->src_h - 1) /
+                 scaler->src_h);
+    dx1 = SDL_min(dx1, scaler->dst_w);
+    dy1 = SDL_min(dy1, scaler->dst_h);
+    width = dx1 - dx0;
+
+    rect->x = SDL_VideoViewport.x + dx0;
+    rect->y = SDL_VideoViewport.y + dy0;
+    rect->w = width;
+    rect->h = dy1 - dy0;
+    if (width <= 0 || dy1 <= dy0) {
+        return;
+    }
+
+    dst = (Uint8 *) SDL_WindowSurface->pixels + rect->y * dst_pitch +
+        rect->x * sizeof(Uint32);
+    for (dy = dy0; dy < dy1; ++dy, dst += dst_pitch) {
+        out = (Uint32 *) dst;
+        pos = scaler->ymap[dy];
+        if (pos == last) {
+            /* Scaling up repeats rows */
+            SDL_memcpy(out, prev, width * sizeof(Uint32));
+            continue;
+        }
+        if (scaler->mode == COMPAT_SCALE_LINEAR) {
+            ScaleLinearRow(src, src_pitch, pos, out, dx0, width);
+        } else {
+            ScaleNearestRow((const Uint32 *) (src + pos * src_pitch), out,
+                            dx0, width);
+        }
+        last = pos;
+        prev = out;
+    }
+}
+
+/* Put converted rectangles of the video surface on screen */
+static void
+SDL_PresentVideoRects(int numrects, SDL_Rect * rects)
+{
+    int i;
+
+    if (SDL_VideoRenderer) {
+        /* The renderer takes care of the viewport */
+        SDL_PresentTexture(numrects, rects);
+        return;
+    }
+
+    if (SDL_VideoScale) {
+        if (!SetupVideoScaler()) {
+            return;
+        }
+        for (i = 0; i < numrects; ++i) {
+            ScaleVideoRect(&rects[i]);
+        }
+        SDL_UpdateWindowSurfaceRects(SDL_VideoWindow, rects, numrects);
+        return;
+    }
+
+    /* Offset all the rectangles before updating, they're ours now */
+    if (SDL_VideoViewport.x || SDL_VideoViewport.y) {
+        for (i = 0; i < numrects; ++i) {
+            rects[i].x += SDL_VideoViewport.x;
+            rects[i].y += SDL_VideoViewport.y;
+        }
+    }
+    SDL_UpdateWindowSurfaceRects(SDL_VideoWindow, rects, numrects);
+}
+
+static void
+SDL_PresentRects(SDL_Surface * screen, int numrects, SDL_Rect * rects)
+{
+    Uint64 start = SDL_Metrics ? SDL_GetPerformanceCounter() : 0;
+    SDL_bool whole_window = SDL_FALSE;
+    SDL_Rect all;
+
+    numrects = CoalesceUpdateRects(screen, numrects, rects, &rects);
+    if (numrects == 0) {
+        return;
+    }
+
+    /* The first present after resizing puts up the whole new screen */
+    if (SDL_ResizePending && screen == SDL_PublicSurface) {
+        if (SDL_ShadowSurface) {
+            SDL_InvalidateMap(SDL_ShadowSurface->map);
+        }
+        all.x = 0;
+        all.y = 0;
+        all.w = screen->w;
+        all.h = screen->h;
+        rects = &all;
+        numrects = 1;
+        /* ... and the black borders around it */
+        whole_window = (!SDL_VideoRenderer &&
+                        (SDL_VideoViewport.x || SDL_VideoViewport.y));
+        SDL_ResizePending = SDL_FALSE;
+    }
+
+    /* Stay out of the present thread's way */
+    if (SDL_Flipper.thread) {
+        SDL_LockMutex(SDL_Flipper.present);
+    }
+    if (screen == SDL_ShadowSurface) {
+        SDL_ConvertShadowRects(SDL_ShadowSurface, numrects, rects);
+    }
+    if (whole_window) {
+        SDL_UpdateWindowSurface(SDL_VideoWindow);
+    } else {
+        SDL_PresentVideoRects(numrects, rects);
+    }
+    SDL_CountPresent(start, numrects);
+    if (SDL_Flipper.thread) {
+        SDL_UnlockMutex(SDL_Flipper.present);
+    }
+}
+
+/* Present everything deferred presentation has been holding back */
+static void
+SDL_FlushUpdates(void)
+{
+    if (SDL_NumPendingRects) {
+        SDL_PresentRects(SDL_PendingScreen, SDL_NumPendingRects,
+                         SDL_PendingRects);
+        SDL_NumPendingRects = 0;
+    }
+    SDL_PendingScreen = NULL;
+}
+
+static void
+SDL_DeferUpdateRects(SDL_Surface * screen, int numrects, SDL_Rect * rects)
+{
+    int needed;
+
+    if (SDL_PendingScreen != screen) {
+        SDL_FlushUpdates();
+        SDL_PendingScreen = screen;
+    }
+    if (SDL_NumPendingRects == 0) {
+        SDL_PendingSince = SDL_GetTicks();
+    }
+
+    needed = SDL_NumPendingRects + numrects;
+    if (needed > SDL_PendingRectsSize) {
+        int size = SDL_max(needed, 2 * SDL_PendingRectsSize);
+        SDL_Rect *pending;
+
+        pending = (SDL_Rect *) SDL_realloc(SDL_PendingRects,
+                                           size * sizeof(*pending));
+        if (!pending) {
+            /* Just do it now, then */
+            SDL_FlushUpdates();
+            SDL_PresentRects(screen, numrects, rects);
+            return;
+        }
+        SDL_PendingRects = pending;
+        SDL_PendingRectsSize = size;
+    }
+    SDL_memcpy(&SDL_PendingRects[SDL_NumPendingRects], rects,
+               numrects * sizeof(*rects));
+    SDL_NumPendingRects = needed;
+
+    /* Don't hold on to a frame for longer than we were asked to */
+    if (SDL_TICKS_PASSED(SDL_GetTicks(),
+                         SDL_PendingSince + SDL_DeferredPresent)) {
+        SDL_FlushUpdates();
+    }
+}
+
+void
+SDL_UpdateRects(SDL_Surface * screen, int numrects, SDL_Rect * rects)
+{
+    COMPAT_TRACE("SDL_UpdateRects");
+
+    if (!screen ||
+        (screen != SDL_ShadowSurface && screen != SDL_VideoSurface)) {
+        return;
+    }
+
+    if (SDL_DeferredPresent) {
+        SDL_DeferUpdateRects(screen, numrects, rects);
+    } else {
+        SDL_PresentRects(screen, numrects, rects);
+    }
+}
+
+/* === Asynchronous presentation === */
+
+/* With SDL_DOUBLEBUF, SDL_Flip can hand the frame to a thread of its own.
+ *  The application draws into one of three buffers behind the shadow
+ *  surface, SDL_Flip swaps it with the last finished one, and the present
+ *  thread converts and shows whichever finished buffer is newest.
+ */
+static int SDLCALL
+SDL_PresentThread(void *unused)
+{
+    SDL_Rect rect;
+    SDL_bool resized;
+    int swap;
+
+    SDL_LockMutex(SDL_Flipper.lock);
+    for (;;) {
+        while (!SDL_Flipper.pending && !SDL_Flipper.quit) {
+            SDL_CondWait(SDL_Flipper.flipped, SDL_Flipper.lock);
+        }
+        /* Finish the last frame before quitting */
+        if (!SDL_Flipper.pending) {
+            break;
+        }
+        SDL_UnlockMutex(SDL_Flipper.lock);
+
+        /* Resizing takes the present lock first and drops the frame */
+        SDL_LockMutex(SDL_Flipper.present);
+        SDL_LockMutex(SDL_Flipper.lock);
+        if (!SDL_Flipper.pending) {
+            SDL_UnlockMutex(SDL_Flipper.present);
+            continue;
+        }
+        swap = SDL_Flipper.ready;
+        SDL_Flipper.ready = SDL_Flipper.shown;
+        SDL_Flipper.shown = swap;
+        SDL_Flipper.pending = SDL_FALSE;
+        resized = SDL_Flipper.resized;
+        SDL_Flipper.resized = SDL_FALSE;
+        SDL_UnlockMutex(SDL_Flipper.lock);
+
+        SDL_Flipper.surface->pixels = SDL_Flipper.buffers[SDL_Flipper.shown];
+        rect.x = 0;
+        rect.y = 0;
+        rect.w = SDL_Flipper.surface->w;
+        rect.h = SDL_Flipper.surface->h;
+        {
+            Uint64 start = SDL_Metrics ? SDL_GetPerformanceCounter() : 0;
+            COMPAT_TRACE("SDL_PresentThread");
+
+            SDL_ConvertShadowRects(SDL_Flipper.surface, 1, &rect);
+            /* The first frame at a new size brings the borders with it */
+            if (resized && !SDL_VideoRenderer &&
+                (SDL_VideoViewport.x || SDL_VideoViewport.y)) {
+                SDL_UpdateWindowSurface(SDL_VideoWindow);
+            } else {
+                SDL_PresentVideoRects(1, &rect);
+            }
+            SDL_CountPresent(start, 1);
+        }
+        SDL_UnlockMutex(SDL_Flipper.present);
+
+        SDL_LockMutex(SDL_Flipper.lock);
+    }
+    SDL_UnlockMutex(SDL_Flipper.lock);
+    return 0;
+}
+
+static void
+StopAsyncPresent(void)
+{
+    size_t size;
+    int i;
+
+    if (!SDL_Flipper.thread) {
+        return;
+    }
+
+    SDL_LockMutex(SDL_Flipper.lock);
+    SDL_Flipper.quit = SDL_TRUE;
+    SDL_CondSignal(SDL_Flipper.flipped);
+    SDL_UnlockMutex(SDL_Flipper.lock);
+    SDL_WaitThread(SDL_Flipper.thread, NULL);
+    SDL_Flipper.thread = NULL;
+
+    /* Give the shadow surface its own pixels back, showing what's on screen */
+    size = (size_t) SDL_ShadowSurface->h * SDL_ShadowSurface->pitch;
+    if (SDL_Flipper.buffers[SDL_Flipper.shown] != SDL_Flipper.original) {
+        SDL_memcpy(SDL_Flipper.original,
+                   SDL_Flipper.buffers[SDL_Flipper.shown], size);
+    }
+    SDL_ShadowSurface->pixels = SDL_Flipper.original;
+    for (i = 0; i < SDL_arraysize(SDL_Flipper.buffers); ++i) {
+        if (SDL_Flipper.buffers[i] != SDL_Flipper.original) {
+            SDL_free(SDL_Flipper.buffers[i]);
+        }
+        SDL_Flipper.buffers[i] = NULL;
+        SDL_Flipper.capacity[i] = 0;
+    }
+    SDL_FreeSurface(SDL_Flipper.surface);
+    SDL_Flipper.surface = NULL;
+}
+
+/* Hold the present thread off while the screen is resized under it.  A
+ *  frame it hasn't picked up is dropped, the resize clears the screen
+ *  anyway, and the shadow surface gets its own pixels back to grow.
+ */
+static void
+PauseAsyncPresent(void)
+{
+    int i;
+
+    if (!SDL_Flipper.thread) {
+        return;
+    }
+
+    SDL_LockMutex(SDL_Flipper.present);
+    SDL_LockMutex(SDL_Flipper.lock);
+    SDL_Flipper.pending = SDL_FALSE;
+    /* Count the original as shown, nothing else reads it meanwhile */
+    for (i = 0; i < SDL_arraysize(SDL_Flipper.buffers); ++i) {
+        if (SDL_Flipper.buffers[i] == SDL_Flipper.original) {
+            break;
+        }
+    }
+    if (SDL_Flipper.draw == i) {
+        SDL_Flipper.draw = SDL_Flipper.shown;
+    } else if (SDL_Flipper.ready == i) {
+        SDL_Flipper.ready = SDL_Flipper.shown;
+    }
+    SDL_Flipper.shown = i;
+    SDL_UnlockMutex(SDL_Flipper.lock);
+
+    SDL_ShadowSurface->pixels = SDL_Flipper.original;
+}
+
+/* Let the present thread go again, with buffers for the new size if the
+ *  resize worked.  They grow like the shadow surface's pixels do.
+ */
+static void
+ResumeAsyncPresent(SDL_bool resized)
+{
+    SDL_Surface *shadow = SDL_ShadowSurface;
+    void *pixels;
+    size_t size;
+    int i;
+
+    if (!SDL_Flipper.thread) {
+        return;
+    }
+    if (!resized) {
+        SDL_UnlockMutex(SDL_Flipper.present);
+        return;
+    }
+
+    /* The original may have moved as it grew */
+    SDL_Flipper.original = shadow->pixels;
+    SDL_Flipper.buffers[SDL_Flipper.shown] = shadow->pixels;
+    size = (size_t) shadow->h * shadow->pitch;
+    for (i = 0; i < SDL_arraysize(SDL_Flipper.buffers); ++i) {
+        if (i == SDL_Flipper.shown) {
+            continue;
+        }
+        pixels = GrowPixels(SDL_Flipper.buffers[i],
+                            &SDL_Flipper.capacity[i], size);
+        if (!pixels) {
+            /* Never mind, SDL_Flip will just block */
+            SDL_UnlockMutex(SDL_Flipper.present);
+            StopAsyncPresent();
+            return;
+        }
+        SDL_Flipper.buffers[i] = pixels;
+        SDL_memcpy(pixels, shadow->pixels, size);
+    }
+
+    SDL_Flipper.surface->w = shadow->w;
+    SDL_Flipper.surface->h = shadow->h;
+    SDL_Flipper.surface->pitch = shadow->pitch;
+    SDL_SetClipRect(SDL_Flipper.surface, NULL);
+    SDL_InvalidateMap(SDL_Flipper.surface->map);
+    shadow->pixels = SDL_Flipper.buffers[SDL_Flipper.draw];
+    SDL_UnlockMutex(SDL_Flipper.present);
+}
+
+static void
+SetupAsyncPresent(Uint32 flags)
+{
+    SDL_RendererInfo info;
+    SDL_Surface *shadow;
+    size_t size;
+    int i;
+
+    if (!GetConfig()->async_present ||
+        !(flags & SDL_DOUBLEBUF) || (flags & SDL_OPENGL) ||
+        SDL_Flipper.thread) {
+        return;
+    }
+    /* Accelerated renderers can't be used from another thread */
+    if (SDL_VideoRenderer &&
+        (SDL_GetRendererInfo(SDL_VideoRenderer, &info) < 0 ||
+         !(info.flags & SDL_RENDERER_SOFTWARE))) {
+        return;
+    }
+
+    if (!SDL_Flipper.lock) {
+        SDL_Flipper.lock = SDL_CreateMutex();
+        SDL_Flipper.present = SDL_CreateMutex();
+        SDL_Flipper.flipped = SDL_CreateCond();
+    }
+    if (!SDL_Flipper.lock || !SDL_Flipper.present || !SDL_Flipper.flipped) {
+        return;
+    }
+
+    /* The application always draws into memory of our own */
+    if (!SDL_ShadowSurface) {
+        SDL_PixelFormat *vf = SDL_VideoSurface->format;
+
+        shadow = SDL_CreateRGBSurface(0, SDL_VideoSurface->w,
+                                      SDL_VideoSurface->h, vf->BitsPerPixel,
+                                      vf->Rmask, vf->Gmask, vf->Bmask,
+                                      vf->Amask);
+        if (!shadow) {
+            return;
+        }
+        shadow->flags |= (SDL_VideoSurface->flags & ~SDL_PREALLOC);
+        shadow->flags |= SDL_DONTFREE;
+        SDL_BlitSurface(SDL_VideoSurface, NULL, shadow, NULL);
+        SDL_ShadowSurface = shadow;
+        SDL_PublicSurface = SDL_ShadowSurface;
+    }
+    shadow = SDL_ShadowSurface;
+
+    /* The presenter's view of the finished buffers */
+    SDL_Flipper.surface =
+        SDL_CreateRGBSurfaceFrom(NULL, shadow->w, shadow->h,
+                                 shadow->format->BitsPerPixel, shadow->pitch,
+                                 shadow->format->Rmask, shadow->format->Gmask,
+                                 shadow->format->Bmask, shadow->format->Amask);
+    if (!SDL_Flipper.surface) {
+        return;
+    }
+    if (shadow->format->palette) {
+        SDL_SetSurfacePalette(SDL_Flipper.surface, shadow->format->palette);
+    }
+
+    size = (size_t) shadow->h * shadow->pitch;
+    SDL_Flipper.original = shadow->pixels;
+    SDL_Flipper.buffers[0] = shadow->pixels;
+    for (i = 1; i < SDL_arraysize(SDL_Flipper.buffers); ++i) {
+        SDL_Flipper.buffers[i] = SDL_malloc(size);
+        if (!SDL_Flipper.buffers[i]) {
+            break;
+        }
+        SDL_Flipper.capacity[i] = size;
+        SDL_memcpy(SDL_Flipper.buffers[i], shadow->pixels, size);
+    }
+    SDL_Flipper.draw = 0;
+    SDL_Flipper.ready = 1;
+    SDL_Flipper.shown = 2;
+    SDL_Flipper.pending = SDL_FALSE;
+    SDL_Flipper.resized = SDL_FALSE;
+    SDL_Flipper.quit = SDL_FALSE;
+    if (i == SDL_arraysize(SDL_Flipper.buffers)) {
+        SDL_Flipper.thread =
+            SDL_CreateThread(SDL_PresentThread, "SDL_compat present", NULL);
+    }
+    if (!SDL_Flipper.thread) {
+        /* Never mind, SDL_Flip will just block */
+        while (--i > 0) {
+            SDL_free(SDL_Flipper.buffers[i]);
+            SDL_Flipper.buffers[i] = NULL;
+        }
+        SDL_FreeSurface(SDL_Flipper.surface);
+        SDL_Flipper.surface = NULL;
+    }
+}
+
+static int
+SDL_AsyncFlip(SDL_Surface * screen)
+{
+    int swap;
+
+    /* The pixels are about to move, they can't while someone's using them */
+    if (screen->locked) {
+        SDL_SetError("SDL_Flip() called on a locked screen surface");
+        return -1;
+    }
+
+    /* Anything still held back is part of this frame anyway */
+    SDL_NumPendingRects = 0;
+    SDL_PendingScreen = NULL;
+
+    SDL_LockMutex(SDL_Flipper.lock);
+    swap = SDL_Flipper.draw;
+    SDL_Flipper.draw = SDL_Flipper.ready;
+    SDL_Flipper.ready = swap;
+    SDL_Flipper.pending = SDL_TRUE;
+    /* The present thread puts up the whole new screen, see SDL_PresentRects */
+    if (SDL_ResizePending) {
+        SDL_Flipper.resized = SDL_TRUE;
+        SDL_ResizePending = SDL_FALSE;
+    }
+    screen->pixels = SDL_Flipper.buffers[SDL_Flipper.draw];
+    SDL_CondSignal(SDL_Flipper.flipped);
+    SDL_UnlockMutex(SDL_Flipper.lock);
+    return 0;
+}
+
+int
+SDL_Init(Uint32 flags)
+{
+    int retval = SDL2_Init(flags);
+
+    if (retval == 0 && (flags & SDL_INIT_VIDEO)) {
+        StartDisplayProbe();
+    }
+    return retval;
+}
+
+int
+SDL_InitSubSystem(Uint32 flags)
+{
+    int retval = SDL2_InitSubSystem(flags);
+
+    if (retval == 0 && (flags & SDL_INIT_VIDEO)) {
+        StartDisplayProbe();
+    }
+    return retval;
+}
+
+void
+SDL_QuitSubSystem(Uint32 flags)
+{
+    if (flags & SDL_INIT_VIDEO) {
+        StopAsyncPresent();
+        StopWorkers();
+        StopVideoScaling();
+        InvalidateModeCache();
+    }
+    SDL2_QuitSubSystem(flags);
+}
+
+void
+SDL_Quit(void)
+{
+    /* The present thread mustn't outlive the window */
+    StopAsyncPresent();
+    StopWorkers();
+    StopVideoScaling();
+    InvalidateModeCache();
+    if (SDL_TraceEnabled) {
+        SDL_TraceDump();
+    }
+    SDL2_Quit();
+}
 
-    switch (vf->BytesPerPixel) {
-    case 2:
-        /* For XGY5[56]5, use, AXGY8888, where {X, Y} = {R, B}.
-           For anything else (like ARGB4444) it doesn't matter
-           since we have no special code for it anyway */
-        if ((vf->Rmask == 0x1f) &&
-            (vf->Bmask == 0xf800 || vf->Bmask == 0x7c00)) {
-            rmask = 0xff;
-            bmask = 0xff0000;
-        }
-        break;
+void
+SDL_WM_SetCaption(const char *title, const char *icon)
+{
+    if (wm_title) {
+        SDL_free(wm_title);
+    }
+    if (title) {
+        wm_title = SDL_strdup(title);
+    } else {
+        wm_title = NULL;
+    }
+    SDL_SetWindowTitle(SDL_VideoWindow, wm_title);
+}
 
-    case 3:
-    case 4:
-        /* Keep the video format, as long as the high 8 bits are
-           unused or alpha */
-        if ((vf->Rmask == 0xff) && (vf->Bmask == 0xff0000)) {
-            rmask = 0xff;
-            bmask = 0xff0000;
+void
+SDL_WM_GetCaption(const char **title, const char **icon)
+{
+    if (title) {
+        *title = wm_title;
+    }
+    if (icon) {
+        *icon = "";
+    }
+}
+
+void
+SDL_WM_SetIcon(SDL_Surface * icon, Uint8 * mask)
+{
+    SDL_VideoIcon = icon;
+    ++SDL_VideoIcon->refcount;
+}
+
+int
+SDL_WM_IconifyWindow(void)
+{
+    SDL_MinimizeWindow(SDL_VideoWindow);
+    return 0;
+}
+
+/* Move the screen's pixels out of the window surface into memory of our
+ *  own, once, so the window surface can come and go under them.  The
+ *  public surface stays the same object and becomes the shadow surface.
+ */
+static int
+RetainVideoSurface(void)
+{
+    SDL_Surface *retained = SDL_VideoSurface;
+    Uint8 *pixels, *src, *dst;
+    int pitch, length, row;
+
+    pitch = SDL_CalculatePitch(retained);
+    pixels = (Uint8 *) SDL_malloc(retained->h * pitch);
+    if (!pixels) {
+        SDL_OutOfMemory();
+        return -1;
+    }
+    length = retained->w * retained->format->BytesPerPixel;
+    src = (Uint8 *) retained->pixels;
+    dst = pixels;
+    for (row = 0; row < retained->h; ++row) {
+        SDL_memcpy(dst, src, length);
+        src += retained->pitch;
+        dst += pitch;
+    }
+
+    SDL_VideoSurface = SDL_CreateRGBSurfaceFrom(NULL, 0, 0, 32, 0, 0, 0, 0, 0);
+    if (!SDL_VideoSurface) {
+        SDL_VideoSurface = retained;
+        SDL_free(pixels);
+        return -1;
+    }
+    SDL_VideoSurface->flags = retained->flags;
+    SDL_VideoSurface->flags |= SDL_PREALLOC;
+    SDL_FreeFormat(SDL_VideoSurface->format);
+    SDL_VideoSurface->format = retained->format;
+    SDL_VideoSurface->format->refcount++;
+    SDL_VideoSurface->w = retained->w;
+    SDL_VideoSurface->h = retained->h;
+
+    SDL_ShadowSurface = retained;
+    SDL_ShadowSurface->pixels = pixels;
+    SDL_ShadowSurface->pitch = pitch;
+    SDL_ShadowSurface->flags &= ~SDL_PREALLOC;
+    SDL_SetClipRect(SDL_ShadowSurface, NULL);
+    return 0;
+}
+
+/* Switches between a window and borderless desktop fullscreen, so there's
+ *  no mode change to wait for.  The application's pixels stay where they
+ *  are, only the video surface moves to the new window surface, or scales
+ *  into it with SDL_COMPAT_SCALE, before the screen is presented once.
+ */
+/* The physical switch, then putting the screen up in whatever the window
+ *  turned into.  Software screens go to desktop fullscreen, centred or
+ *  scaled into it, OpenGL ones need the real mode they render for.
+ */
+static int
+SwitchFullScreen(void)
+{
+    Uint32 fullscreen = SDL_WINDOW_FULLSCREEN_DESKTOP;
+    Uint64 present;
+    SDL_Rect rect;
+
+    if (SDL_PublicSurface->flags & SDL_OPENGL) {
+        fullscreen = SDL_WINDOW_FULLSCREEN;
+    }
+    if (SDL_GetWindowFlags(SDL_VideoWindow) & SDL_WINDOW_FULLSCREEN) {
+        if (SDL_SetWindowFullscreen(SDL_VideoWindow, 0) < 0) {
+            return -1;
         }
-        break;
+        SDL_PublicSurface->flags &= ~SDL_FULLSCREEN;
+    } else {
+        if (SDL_SetWindowFullscreen(SDL_VideoWindow, fullscreen) < 0) {
+            return -1;
+        }
+        SDL_PublicSurface->flags |= SDL_FULLSCREEN;
+    }
+    ++SDL_VideoModeSerial;
 
-    default:
-        /* We have no other optimised formats right now. When/if a new
-           optimised alpha format is written, add the converter here */
-        break;
+    if (SDL_PublicSurface->flags & SDL_OPENGL) {
+        return 0;
     }
-    format = SDL_AllocFormat(SDL_MasksToPixelFormatEnum(32, rmask,
-                                                            gmask,
-                                                            bmask,
-                                                            amask));
-    if (!format) {
-        return NULL;
+
+    /* Anything deferred goes out with the whole screen below */
+    SDL_NumPendingRects = 0;
+    SDL_PendingScreen = NULL;
+
+    if (SDL_VideoRenderer) {
+        SetupTextureScaling(GetScaleMode());
+        SDL_Flip(SDL_PublicSurface);
+        return 0;
     }
-    converted = SDL_ConvertSurface(surface, format, SDL_RLEACCEL);
-    SDL_FreeFormat(format);
-    return converted;
+
+    /* Rebind the video surface to the new window surface */
+    SDL_WindowSurface = SDL_GetWindowSurface(SDL_VideoWindow);
+    if (!SDL_WindowSurface) {
+        /* We're totally hosed... */
+        return -1;
+    }
+    if (SDL_VideoSurface->format->format != SDL_WindowSurface->format->format) {
+        SDL_FreeFormat(SDL_VideoSurface->format);
+        SDL_VideoSurface->format = SDL_WindowSurface->format;
+        SDL_VideoSurface->format->refcount++;
+        SDL_InvalidateMap(SDL_ShadowSurface->map);
+    }
+    if (BindVideoSurface() < 0) {
+        return -1;
+    }
+
+    /* Only this much counts as presenting, the switch itself is in
+       toggle_us */
+    present = SDL_Metrics ? SDL_GetPerformanceCounter() : 0;
+
+    /* Black borders around the screen, presented together with it */
+    SDL_FillRect(SDL_WindowSurface, NULL, 0);
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = SDL_ShadowSurface->w;
+    rect.h = SDL_ShadowSurface->h;
+    SDL_ConvertShadowRects(SDL_ShadowSurface, 1, &rect);
+    if (SDL_VideoScale && SetupVideoScaler()) {
+        ScaleVideoRect(&rect);
+    }
+    SDL_UpdateWindowSurface(SDL_VideoWindow);
+    SDL_CountPresent(present, 1);
+    return 0;
 }
 
 int
-SDL_Flip(SDL_Surface * screen)
+SDL_WM_ToggleFullScreen(SDL_Surface * surface)
 {
-    SDL_UpdateRect(screen, 0, 0, 0, 0);
-    return 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    int retval = 0;
+    COMPAT_TRACE("SDL_WM_ToggleFullScreen");
+
+    if (!SDL_PublicSurface) {
+        SDL_SetError("SDL_SetVideoMode() hasn't been called");
+        return 0;
+    }
+
+    /* The screen is about to change under the present thread */
+    StopAsyncPresent();
+
+    /* Renderer modes keep their pixels to themselves already */
+    if (!SDL_VideoRenderer && !SDL_ShadowSurface &&
+        !(SDL_PublicSurface->flags & SDL_OPENGL)) {
+        retval = RetainVideoSurface();
+    }
+    if (retval == 0) {
+        retval = SwitchFullScreen();
+    }
+
+    /* Failed or not, the present thread goes on as before */
+    SetupAsyncPresent(SDL_VideoFlags);
+    if (retval < 0) {
+        return 0;
+    }
+
+    COMPAT_METRIC_SET(toggle_us, (SDL_GetPerformanceCounter() - start) *
+                      1000000 / SDL_GetPerformanceFrequency());
+
+    /* We're done! */
+    return 1;
+}
+
+SDL_GrabMode
+SDL_WM_GrabInput(SDL_GrabMode mode)
+{
+    if (mode != SDL_GRAB_QUERY) {
+        SDL_SetWindowGrab(SDL_VideoWindow, mode);
+    }
+    return (SDL_GrabMode) SDL_GetWindowGrab(SDL_VideoWindow);
 }
 
 void
-SDL_UpdateRect(SDL_Surface * screen, Sint32 x, Sint32 y, Uint32 w, Uint32 h)
+SDL_WarpMouse(Uint16 x, Uint16 y)
 {
-    if (screen) {
-        SDL_Rect rect;
+    int window_x = x;
+    int window_y = y;
+
+    /* The other way from MapMousePosition() */
+    if (SDL_PublicSurface && SDL_PublicSurface->w > 0 &&
+        SDL_PublicSurface->h > 0) {
+        window_x = SDL_VideoViewport.x +
+            (int) ((Sint64) x * SDL_VideoViewport.w / SDL_PublicSurface->w);
+        window_y = SDL_VideoViewport.y +
+            (int) ((Sint64) y * SDL_VideoViewport.h / SDL_PublicSurface->h);
+    }
+    SDL_WarpMouseInWindow(SDL_VideoWindow, window_x, window_y);
+}
 
-        /* Fill the rectangle */
-        rect.x = (int) x;
-        rect.y = (int) y;
-        rect.w = (int) (w ? w : screen->w);
-        rect.h = (int) (h ? h : screen->h);
-        SDL_UpdateRects(screen, 1, &rect);
+Uint8
+SDL_GetAppState(void)
+{
+    Uint8 state = 0;
+    Uint32 flags = 0;
+
+    flags = SDL_GetWindowFlags(SDL_VideoWindow);
+    if ((flags & SDL_WINDOW_SHOWN) && !(flags & SDL_WINDOW_MINIMIZED)) {
+        state |= SDL_APPACTIVE;
+    }
+    if (flags & SDL_WINDOW_INPUT_FOCUS) {
+        state |= SDL_APPINPUTFOCUS;
+    }
+    if (flags & SDL_WINDOW_MOUSE_FOCUS) {
+        state |= SDL_APPMOUSEFOCUS;
     }
+    return state;
 }
 
-void
-SDL_UpdateRects(SDL_Surface * screen, int numrects, SDL_Rect * rects)
+const SDL_version *
+SDL_Linked_Version(void)
 {
-    int i;
+    static SDL_version version;
+    SDL_VERSION(&version);
+    return &version;
+}
 
-    if (screen == SDL_ShadowSurface) {
-        for (i = 0; i < numrects; ++i) {
-            SDL_BlitSurface(SDL_ShadowSurface, &rects[i], SDL_VideoSurface,
-                            &rects[i]);
-        }
-
-        /* Fall through to video surface update */
-        screen = SDL_VideoSurface;
-    }
-    if (screen == SDL_VideoSurface) {
-        if (SDL_VideoViewport.x || SDL_VideoViewport.y) {
-            SDL_Rect *stackrects = SDL_stack_alloc(SDL_Rect, numrects);
-            SDL_Rect *stackrect;
-            const SDL_Rect *rect;
-            
-            /* Offset all the rectangles before updating */
-            for (i = 0; i < numrects; ++i) {
-                rect = &rects[i];
-                stackrect = &stackrects[i];
-                stackrect->x = SDL_VideoViewport.x + rect->x;
-                stackrect->y = SDL_VideoViewport.y + rect->y;
-                stackrect->w = rect->w;
-                stackrect->h = rect->h;
-            }
-            SDL_UpdateWindowSurfaceRects(SDL_VideoWindow, stackrects, numrects);
-            SDL_stack_free(stackrects);
-        } else {
-            SDL_UpdateWindowSurfaceRects(SDL_VideoWindow, rects, numrects);
-        }
+int
+SDL_SetColors(SDL_Surface * surface, const SDL_Color * colors, int firstcolor,
+              int ncolors)
+{
+    if (SDL_SetPaletteColors
+        (surface->format->palette, colors, firstcolor, ncolors) == 0) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+
+int
+SDL_SetPalette(SDL_Surface * surface, int flags, const SDL_Color * colors,
+               int firstcolor, int ncolors)
+{
+    return SDL_SetColors(surface, colors, firstcolor, ncolors);
+}
+
+int
+SDL_GetWMInfo(SDL_SysWMinfo * info)
+{
+    return SDL_GetWindowWMInfo(SDL_VideoWindow, info);
+}
+
+/* === YUV overlays === */
+
+/* Overlay backends, modelled on SDL 1.2's SDL_yuvfuncs.h */
+struct private_yuvhwfuncs
+{
+    int (*Lock) (SDL_Overlay * overlay);
+    void (*Unlock) (SDL_Overlay * overlay);
+    int (*Display) (SDL_Overlay * overlay, SDL_Rect * src, SDL_Rect * dst);
+    void (*FreeHW) (SDL_Overlay * overlay);
+};
+
+struct private_yuvhwdata
+{
+    Uint16 pitches[3];
+    Uint8 *planes[3];
+
+    /* Software backend */
+    Uint8 *pixels;              /* All of the planes, in one allocation */
+    Uint8 *yrow, *urow, *vrow;  /* Packed formats unpacked to planar */
+    Uint32 *argbrow;            /* One converted scanline, overlay width */
+    Uint32 *scalerow;           /* One scaled scanline, display width */
+    SDL_Surface *rowsurface;    /* scalerow wrapped for SDL_LowerBlit */
+
+    /* Texture backend */
+    SDL_Renderer *renderer;     /* Software renderer on the screen surface */
+    SDL_Texture *texture;       /* Streaming texture the planes live in */
+    Uint32 serial;              /* SDL_VideoModeSerial the renderer was made for */
+};
+
+/* Scanline converters: planar 4:2:2 in, ARGB8888 out.
+ *
+ * BT.601 studio swing, 6 bits of fraction (plus rounding) so the SIMD
+ *  kernels can stay in 16-bit lanes.  Every kernel must produce results
+ *  bit-identical to the scalar one; the only saturation the SIMD adds can
+ *  hit is on values that are clamped to 255 anyway.
+ */
+#define YUV_CY   74              /* Plus a half, added as a shift */
+#define YUV_CRV  102
+#define YUV_CGU  25
+#define YUV_CGV  52
+#define YUV_CBU  129
+
+typedef void (*SDL_YUVRowFunc) (const Uint8 * y, const Uint8 * u,
+                                const Uint8 * v, Uint32 * dst, int width);
+
+static SDL_YUVRowFunc SDL_YUVToARGBRow = NULL;   /* Picked at load time */
+
+static SDL_INLINE Uint32
+YUVToARGBPixel(int y, int u, int v)
+{
+    int r, g, b;
+
+    y -= 16;
+    y = y * YUV_CY + (y >> 1) + 32;
+    u -= 128;
+    v -= 128;
+    r = (y + YUV_CRV * v) >> 6;
+    g = (y - YUV_CGV * v - YUV_CGU * u) >> 6;
+    b = (y + YUV_CBU * u) >> 6;
+    r = r < 0 ? 0 : (r > 255 ? 255 : r);
+    g = g < 0 ? 0 : (g > 255 ? 255 : g);
+    b = b < 0 ? 0 : (b > 255 ? 255 : b);
+    return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+static void
+YUVToARGBRow_Scalar(const Uint8 * y, const Uint8 * u, const Uint8 * v,
+                    Uint32 * dst, int width)
+{
+    int x;
+
+    for (x = 0; x < width; ++x) {
+        dst[x] = YUVToARGBPixel(y[x], u[x >> 1], v[x >> 1]);
+    }
+}
+
+#ifdef HAVE_COMPAT_X86_KERNELS
+
+/* 8 pixels: y holds Y0..Y7, uv holds U0..U3 and V0..V3 as int16 */
+__attribute__((target("sse2")))
+static SDL_INLINE void
+YUVToARGB8_SSE2(__m128i y, __m128i u, __m128i v, Uint32 * dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(255);
+    __m128i r, g, b, bg, ra;
+
+    y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    y = _mm_add_epi16(_mm_mullo_epi16(y, _mm_set1_epi16(YUV_CY)),
+                      _mm_add_epi16(_mm_srai_epi16(y, 1), _mm_set1_epi16(32)));
+    u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+    /* Duplicate each chroma sample across its pixel pair */
+    u = _mm_unpacklo_epi16(u, u);
+    v = _mm_unpacklo_epi16(v, v);
+
+    r = _mm_adds_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(YUV_CRV)));
+    g = _mm_subs_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(YUV_CGV)));
+    g = _mm_subs_epi16(g, _mm_mullo_epi16(u, _mm_set1_epi16(YUV_CGU)));
+    b = _mm_adds_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(YUV_CBU)));
+    r = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(r, 6), zero), max);
+    g = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(g, 6), zero), max);
+    b = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(b, 6), zero), max);
+
+    bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    ra = _mm_or_si128(r, _mm_set1_epi16((short) 0xff00));
+    _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(bg, ra));
+    _mm_storeu_si128((__m128i *) (dst + 4), _mm_unpackhi_epi16(bg, ra));
+}
+
+__attribute__((target("sse2")))
+static void
+YUVToARGBRow_SSE2(const Uint8 * y, const Uint8 * u, const Uint8 * v,
+                  Uint32 * dst, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m128i yy = _mm_loadl_epi64((const __m128i *) (y + x));
+        int u4, v4;
+        __m128i uu, vv;
+
+        SDL_memcpy(&u4, u + x / 2, sizeof(u4));
+        SDL_memcpy(&v4, v + x / 2, sizeof(v4));
+        uu = _mm_cvtsi32_si128(u4);
+        vv = _mm_cvtsi32_si128(v4);
+        YUVToARGB8_SSE2(_mm_unpacklo_epi8(yy, zero),
+                        _mm_unpacklo_epi8(uu, zero),
+                        _mm_unpacklo_epi8(vv, zero), dst + x);
+    }
+    for (; x < width; ++x) {
+        dst[x] = YUVToARGBPixel(y[x], u[x >> 1], v[x >> 1]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+YUVToARGBRow_AVX2(const Uint8 * y, const Uint8 * u, const Uint8 * v,
+                  Uint32 * dst, int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi16(255);
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m256i yy, uu, vv, r, g, b, bg, ra, lo, hi;
+        __m128i u8, v8;
+
+        yy = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (y + x)));
+        u8 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (u + x / 2)));
+        v8 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (v + x / 2)));
+        /* Duplicate each chroma sample across its pixel pair */
+        uu = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                 _mm_unpacklo_epi16(u8, u8)), _mm_unpackhi_epi16(u8, u8), 1);
+        vv = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                 _mm_unpacklo_epi16(v8, v8)), _mm_unpackhi_epi16(v8, v8), 1);
+
+        yy = _mm256_sub_epi16(yy, _mm256_set1_epi16(16));
+        yy = _mm256_add_epi16(_mm256_mullo_epi16(yy, _mm256_set1_epi16(YUV_CY)),
+                              _mm256_add_epi16(_mm256_srai_epi16(yy, 1),
+                                               _mm256_set1_epi16(32)));
+        uu = _mm256_sub_epi16(uu, _mm256_set1_epi16(128));
+        vv = _mm256_sub_epi16(vv, _mm256_set1_epi16(128));
+
+        r = _mm256_adds_epi16(yy, _mm256_mullo_epi16(vv, _mm256_set1_epi16(YUV_CRV)));
+        g = _mm256_subs_epi16(yy, _mm256_mullo_epi16(vv, _mm256_set1_epi16(YUV_CGV)));
+        g = _mm256_subs_epi16(g, _mm256_mullo_epi16(uu, _mm256_set1_epi16(YUV_CGU)));
+        b = _mm256_adds_epi16(yy, _mm256_mullo_epi16(uu, _mm256_set1_epi16(YUV_CBU)));
+        r = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(r, 6), zero), max);
+        g = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(g, 6), zero), max);
+        b = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(b, 6), zero), max);
+
+        bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+        ra = _mm256_or_si256(r, _mm256_set1_epi16((short) 0xff00));
+        /* The unpacks work per 128-bit lane: lo = {0-3, 8-11}, hi = {4-7, 12-15} */
+        lo = _mm256_unpacklo_epi16(bg, ra);
+        hi = _mm256_unpackhi_epi16(bg, ra);
+        _mm256_storeu_si256((__m256i *) (dst + x),
+                            _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *) (dst + x + 8),
+                            _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    for (; x < width; ++x) {
+        dst[x] = YUVToARGBPixel(y[x], u[x >> 1], v[x >> 1]);
     }
 }
 
-void
-SDL_WM_SetCaption(const char *title, const char *icon)
+#endif /* HAVE_COMPAT_X86_KERNELS */
+
+static void
+SDL_InitYUVKernels(void)
 {
-    if (wm_title) {
-        SDL_free(wm_title);
-    }
-    if (title) {
-        wm_title = SDL_strdup(title);
-    } else {
-        wm_title = NULL;
+    SDL_YUVToARGBRow = YUVToARGBRow_Scalar;
+#ifdef HAVE_COMPAT_X86_KERNELS
+    if (SDL_CompatCPUFeatures & COMPAT_CPU_AVX2) {
+        SDL_YUVToARGBRow = YUVToARGBRow_AVX2;
+    } else if (SDL_CompatCPUFeatures & COMPAT_CPU_SSE2) {
+        SDL_YUVToARGBRow = YUVToARGBRow_SSE2;
     }
-    SDL_SetWindowTitle(SDL_VideoWindow, wm_title);
+#endif
 }
 
-void
-SDL_WM_GetCaption(const char **title, const char **icon)
+/* Split one packed 4:2:2 scanline into planar Y, U and V rows.
+ * yoff/uoff/voff are the byte offsets of each sample in a 4-byte macropixel.
+ */
+static void
+SDL_UnpackYUVRow(const Uint8 * src, int width, int yoff, int uoff, int voff,
+                 Uint8 * y, Uint8 * u, Uint8 * v)
 {
-    if (title) {
-        *title = wm_title;
+    int x;
+
+    for (x = 0; x < width / 2; ++x) {
+        y[2 * x] = src[yoff];
+        y[2 * x + 1] = src[yoff + 2];
+        u[x] = src[uoff];
+        v[x] = src[voff];
+        src += 4;
     }
-    if (icon) {
-        *icon = "";
+    if (width & 1) {
+        y[width - 1] = src[yoff];
+        u[x] = src[uoff];
+        v[x] = src[voff];
     }
 }
 
-void
-SDL_WM_SetIcon(SDL_Surface * icon, Uint8 * mask)
+/* Convert overlay row 'row' to ARGB8888, starting at an even column 'x' */
+static void
+SW_ConvertYUVRow(SDL_Overlay * overlay, int row, int x, int width,
+                 Uint32 * dst)
 {
-    SDL_VideoIcon = icon;
-    ++SDL_VideoIcon->refcount;
+    struct private_yuvhwdata *swdata = overlay->hwdata;
+    const Uint8 *y, *u, *v, *src;
+
+    switch (overlay->format) {
+    case SDL_YV12_OVERLAY:
+    case SDL_IYUV_OVERLAY:
+        y = swdata->planes[0] + row * swdata->pitches[0] + x;
+        if (overlay->format == SDL_YV12_OVERLAY) {
+            v = swdata->planes[1] + (row / 2) * swdata->pitches[1] + x / 2;
+            u = swdata->planes[2] + (row / 2) * swdata->pitches[2] + x / 2;
+        } else {
+            u = swdata->planes[1] + (row / 2) * swdata->pitches[1] + x / 2;
+            v = swdata->planes[2] + (row / 2) * swdata->pitches[2] + x / 2;
+        }
+        break;
+    default:
+        src = swdata->planes[0] + row * swdata->pitches[0] + x * 2;
+        switch (overlay->format) {
+        case SDL_YUY2_OVERLAY:
+            SDL_UnpackYUVRow(src, width, 0, 1, 3,
+                             swdata->yrow, swdata->urow, swdata->vrow);
+            break;
+        case SDL_UYVY_OVERLAY:
+            SDL_UnpackYUVRow(src, width, 1, 0, 2,
+                             swdata->yrow, swdata->urow, swdata->vrow);
+            break;
+        case SDL_YVYU_OVERLAY:
+            SDL_UnpackYUVRow(src, width, 0, 3, 1,
+                             swdata->yrow, swdata->urow, swdata->vrow);
+            break;
+        }
+        y = swdata->yrow;
+        u = swdata->urow;
+        v = swdata->vrow;
+        break;
+    }
+    SDL_YUVToARGBRow(y, u, v, dst, width);
 }
 
-int
-SDL_WM_IconifyWindow(void)
+static int
+SW_LockYUVOverlay(SDL_Overlay * overlay)
 {
-    SDL_MinimizeWindow(SDL_VideoWindow);
     return 0;
 }
 
-int
-SDL_WM_ToggleFullScreen(SDL_Surface * surface)
+static void
+SW_UnlockYUVOverlay(SDL_Overlay * overlay)
 {
-    int length;
-    void *pixels;
-    Uint8 *src, *dst;
-    int row;
-    int window_w;
-    int window_h;
-
-    if (!SDL_PublicSurface) {
-        SDL_SetError("SDL_SetVideoMode() hasn't been called");
-        return 0;
-    }
-
-    /* Copy the old bits out */
-    length = SDL_PublicSurface->w * SDL_PublicSurface->format->BytesPerPixel;
-    pixels = SDL_malloc(SDL_PublicSurface->h * length);
-    if (pixels && SDL_PublicSurface->pixels) {
-        src = (Uint8*)SDL_PublicSurface->pixels;
-        dst = (Uint8*)pixels;
-        for (row = 0; row < SDL_PublicSurface->h; ++row) {
-            SDL_memcpy(dst, src, length);
-            src += SDL_PublicSurface->pitch;
-            dst += length;
-        }
-    }
+    return;
+}
 
-    /* Do the physical mode switch */
-    if (SDL_GetWindowFlags(SDL_VideoWindow) & SDL_WINDOW_FULLSCREEN) {
-        if (SDL_SetWindowFullscreen(SDL_VideoWindow, 0) < 0) {
-            return 0;
-        }
-        SDL_PublicSurface->flags &= ~SDL_FULLSCREEN;
-    } else {
-        if (SDL_SetWindowFullscreen(SDL_VideoWindow, 1) < 0) {
-            return 0;
+static int
+SW_DisplayYUVOverlay(SDL_Overlay * overlay, SDL_Rect * src, SDL_Rect * dst)
+{
+    struct private_yuvhwdata *swdata = overlay->hwdata;
+    SDL_Surface *display = SDL_PublicSurface;
+    SDL_PixelFormat *fmt = display->format;
+    int direct, row, lastrow;
+    int srcx, srcw;
+    Uint32 xstep;
+    Uint8 *dstrow;
+
+    /* Packed formats share chroma between pixel pairs, start on a pair */
+    srcx = src->x & ~1;
+    srcw = src->w + (src->x - srcx);
+
+    /* ARGB8888/XRGB8888 targets get written without an intermediate row */
+    direct = (fmt->BytesPerPixel == 4 && fmt->Rmask == 0x00ff0000 &&
+              fmt->Gmask == 0x0000ff00 && fmt->Bmask == 0x000000ff &&
+              src->w == dst->w && srcx == src->x);
+
+    if (!direct) {
+        if (!swdata->rowsurface || swdata->rowsurface->w < dst->w) {
+            SDL_FreeSurface(swdata->rowsurface);
+            SDL_free(swdata->scalerow);
+            swdata->scalerow = (Uint32 *) SDL_malloc(dst->w * sizeof(Uint32));
+            if (!swdata->scalerow) {
+                swdata->rowsurface = NULL;
+                SDL_OutOfMemory();
+                return -1;
+            }
+            swdata->rowsurface =
+                SDL_CreateRGBSurfaceFrom(swdata->scalerow, dst->w, 1, 32,
+                                         dst->w * sizeof(Uint32),
+                                         0x00ff0000, 0x0000ff00,
+                                         0x000000ff, 0);
+            if (!swdata->rowsurface) {
+                return -1;
+            }
         }
-        SDL_PublicSurface->flags |= SDL_FULLSCREEN;
     }
 
-    /* Recreate the screen surface */
-    SDL_WindowSurface = SDL_GetWindowSurface(SDL_VideoWindow);
-    if (!SDL_WindowSurface) {
-        /* We're totally hosed... */
-        return 0;
+    if (SDL_MUSTLOCK(display) && SDL_LockSurface(display) < 0) {
+        return -1;
     }
 
-    /* Center the public surface in the window surface */
-    SDL_GetWindowSize(SDL_VideoWindow, &window_w, &window_h);
-    SDL_VideoViewport.x = (window_w - SDL_VideoSurface->w)/2;
-    SDL_VideoViewport.y = (window_h - SDL_VideoSurface->h)/2;
-    SDL_VideoViewport.w = SDL_VideoSurface->w;
-    SDL_VideoViewport.h = SDL_VideoSurface->h;
-
-    /* Do some shuffling behind the application's back if format changes */
-    if (SDL_VideoSurface->format->format != SDL_WindowSurface->format->format) {
-        if (SDL_ShadowSurface) {
-            if (SDL_ShadowSurface->format->format == SDL_WindowSurface->format->format) {
-                /* Whee!  We don't need a shadow surface anymore! */
-                SDL_VideoSurface->flags &= ~SDL_DONTFREE;
-                SDL_FreeSurface(SDL_VideoSurface);
-                SDL_free(SDL_ShadowSurface->pixels);
-                SDL_VideoSurface = SDL_ShadowSurface;
-                SDL_VideoSurface->flags |= SDL_PREALLOC;
-                SDL_ShadowSurface = NULL;
+    /* 16.16 fixed point horizontal step, nearest neighbour */
+    xstep = (Uint32) (((Uint64) src->w << 16) / dst->w);
+    dstrow = (Uint8 *) display->pixels + dst->y * display->pitch +
+        dst->x * fmt->BytesPerPixel;
+    lastrow = -1;
+    for (row = 0; row < dst->h; ++row, dstrow += display->pitch) {
+        int srcrow = src->y + (row * src->h) / dst->h;
+
+        if (direct) {
+            if (srcrow == lastrow) {
+                SDL_memcpy(dstrow, dstrow - display->pitch, dst->w * 4);
             } else {
-                /* No problem, just change the video surface format */
-                SDL_FreeFormat(SDL_VideoSurface->format);
-                SDL_VideoSurface->format = SDL_WindowSurface->format;
-                SDL_VideoSurface->format->refcount++;
-                SDL_InvalidateMap(SDL_ShadowSurface->map);
+                SW_ConvertYUVRow(overlay, srcrow, srcx, srcw,
+                                 (Uint32 *) dstrow);
             }
         } else {
-            /* We can make the video surface the shadow surface */
-            SDL_ShadowSurface = SDL_VideoSurface;
-            SDL_ShadowSurface->pitch = SDL_CalculatePitch(SDL_ShadowSurface);
-            SDL_ShadowSurface->pixels = SDL_malloc(SDL_ShadowSurface->h * SDL_ShadowSurface->pitch);
-            if (!SDL_ShadowSurface->pixels) {
-                /* Uh oh, we're hosed */
-                SDL_ShadowSurface = NULL;
-                return 0;
-            }
-            SDL_ShadowSurface->flags &= ~SDL_PREALLOC;
+            SDL_Rect rowsrc, rowrect;
 
-            SDL_VideoSurface = SDL_CreateRGBSurfaceFrom(NULL, 0, 0, 32, 0, 0, 0, 0, 0);
-            SDL_VideoSurface->flags = SDL_ShadowSurface->flags;
-            SDL_VideoSurface->flags |= SDL_PREALLOC;
-            SDL_FreeFormat(SDL_VideoSurface->format);
-            SDL_VideoSurface->format = SDL_WindowSurface->format;
-            SDL_VideoSurface->format->refcount++;
-            SDL_VideoSurface->w = SDL_ShadowSurface->w;
-            SDL_VideoSurface->h = SDL_ShadowSurface->h;
+            if (srcrow != lastrow) {
+                const Uint32 *argb = swdata->argbrow + (src->x - srcx);
+                Uint32 pos = 0;
+                int x;
+
+                SW_ConvertYUVRow(overlay, srcrow, srcx, srcw,
+                                 swdata->argbrow);
+                for (x = 0; x < dst->w; ++x, pos += xstep) {
+                    swdata->scalerow[x] = argb[pos >> 16];
+                }
+            }
+            rowsrc.x = 0;
+            rowsrc.y = 0;
+            rowsrc.w = dst->w;
+            rowsrc.h = 1;
+            rowrect.x = dst->x;
+            rowrect.y = dst->y + row;
+            rowrect.w = dst->w;
+            rowrect.h = 1;
+            SDL_LowerBlit(swdata->rowsurface, &rowsrc, display, &rowrect);
         }
+        lastrow = srcrow;
     }
 
-    /* Update the video surface */
-    SDL_VideoSurface->pitch = SDL_WindowSurface->pitch;
-    SDL_VideoSurface->pixels = (void *)((Uint8 *)SDL_WindowSurface->pixels +
-        SDL_VideoViewport.y * SDL_VideoSurface->pitch +
-        SDL_VideoViewport.x  * SDL_VideoSurface->format->BytesPerPixel);
-    SDL_SetClipRect(SDL_VideoSurface, NULL);
+    if (SDL_MUSTLOCK(display)) {
+        SDL_UnlockSurface(display);
+    }
 
-    /* Copy the old bits back */
-    if (pixels) {
-        src = (Uint8*)pixels;
-        dst = (Uint8*)SDL_PublicSurface->pixels;
-        for (row = 0; row < SDL_PublicSurface->h; ++row) {
-            SDL_memcpy(dst, src, length);
-            src += length;
-            dst += SDL_PublicSurface->pitch;
-        }
-        SDL_Flip(SDL_PublicSurface);
-        SDL_free(pixels);
+    SDL_UpdateRects(display, 1, dst);
+    return 0;
+}
+
+static void
+SW_FreeYUVOverlay(SDL_Overlay * overlay)
+{
+    struct private_yuvhwdata *swdata = overlay->hwdata;
+
+    if (swdata) {
+        SDL_FreeSurface(swdata->rowsurface);
+        SDL_free(swdata->scalerow);
+        SDL_free(swdata->argbrow);
+        SDL_free(swdata->yrow);
+        SDL_free(swdata->pixels);
+        SDL_free(swdata);
     }
+}
 
-    /* We're done! */
-    return 1;
+static struct private_yuvhwfuncs sw_yuvfuncs = {
+    SW_LockYUVOverlay,
+    SW_UnlockYUVOverlay,
+    SW_DisplayYUVOverlay,
+    SW_FreeYUVOverlay
+};
+
+static SDL_Overlay *
+SW_CreateYUVOverlay(int width, int height, Uint32 format)
+{
+    SDL_Overlay *overlay;
+    struct private_yuvhwdata *swdata;
+    int chroma_w = (width + 1) / 2;
+    size_t size;
+
+    overlay = (SDL_Overlay *) SDL_calloc(1, sizeof(*overlay));
+    swdata = (struct private_yuvhwdata *) SDL_calloc(1, sizeof(*swdata));
+    if (!overlay || !swdata) {
+        SDL_free(overlay);
+        SDL_free(swdata);
+        SDL_OutOfMemory();
+        return NULL;
+    }
+    overlay->format = format;
+    overlay->w = width;
+    overlay->h = height;
+    overlay->hwfuncs = &sw_yuvfuncs;
+    overlay->hwdata = swdata;
+    overlay->pitches = swdata->pitches;
+    overlay->pixels = swdata->planes;
+
+    /* Same plane layout as SDL 1.2's software overlays */
+    switch (format) {
+    case SDL_YV12_OVERLAY:
+    case SDL_IYUV_OVERLAY:
+        overlay->planes = 3;
+        swdata->pitches[0] = width;
+        swdata->pitches[1] = swdata->pitches[0] / 2;
+        swdata->pitches[2] = swdata->pitches[0] / 2;
+        /* Odd heights read one chroma row past the end of the plane */
+        size = width * height + 2 * (swdata->pitches[1] * ((height + 1) / 2));
+        break;
+    default:
+        overlay->planes = 1;
+        swdata->pitches[0] = width * 2;
+        size = width * height * 2;
+        break;
+    }
+
+    /* Slack at the end for odd widths, where the last pixel reads chroma
+       one past the end of its row */
+    swdata->pixels = (Uint8 *) SDL_malloc(size + 16);
+    swdata->argbrow = (Uint32 *) SDL_malloc(width * sizeof(Uint32));
+    swdata->yrow = (Uint8 *) SDL_malloc(width + 2 * chroma_w);
+    if (!swdata->pixels || !swdata->argbrow || !swdata->yrow) {
+        SW_FreeYUVOverlay(overlay);
+        SDL_free(overlay);
+        SDL_OutOfMemory();
+        return NULL;
+    }
+    swdata->urow = swdata->yrow + width;
+    swdata->vrow = swdata->urow + chroma_w;
+
+    swdata->planes[0] = swdata->pixels;
+    if (overlay->planes == 3) {
+        swdata->planes[1] = swdata->planes[0] + swdata->pitches[0] * height;
+        swdata->planes[2] =
+            swdata->planes[1] + swdata->pitches[1] * (height / 2);
+    }
+
+    return overlay;
 }
 
-SDL_GrabMode
-SDL_WM_GrabInput(SDL_GrabMode mode)
+/* The texture backend: the planes the application writes to are the
+ *  locked pixels of a streaming texture, and the renderer does the colour
+ *  conversion and scaling, straight into the screen surface.
+ */
+static void
+TEX_DestroyRenderer(struct private_yuvhwdata *hwdata)
 {
-    if (mode != SDL_GRAB_QUERY) {
-        SDL_SetWindowGrab(SDL_VideoWindow, mode);
+    if (hwdata->texture) {
+        SDL_DestroyTexture(hwdata->texture);
+        hwdata->texture = NULL;
+    }
+    if (hwdata->renderer) {
+        SDL_DestroyRenderer(hwdata->renderer);
+        hwdata->renderer = NULL;
     }
-    return (SDL_GrabMode) SDL_GetWindowGrab(SDL_VideoWindow);
 }
 
-void
-SDL_WarpMouse(Uint16 x, Uint16 y)
+static int
+TEX_CreateRenderer(SDL_Overlay * overlay)
 {
-    SDL_WarpMouseInWindow(SDL_VideoWindow, x, y);
+    struct private_yuvhwdata *hwdata = overlay->hwdata;
+
+    TEX_DestroyRenderer(hwdata);
+
+    /* The software renderer can draw into the screen surface whatever
+       it's backed by, and needs no window of its own */
+    hwdata->renderer = SDL_CreateSoftwareRenderer(SDL_PublicSurface);
+    if (!hwdata->renderer) {
+        return -1;
+    }
+    /* The SDL_*_OVERLAY values are the same FOURCCs as the SDL 2.0
+       pixel formats */
+    hwdata->texture = SDL_CreateTexture(hwdata->renderer, overlay->format,
+                                        SDL_TEXTUREACCESS_STREAMING,
+                                        overlay->w, overlay->h);
+    if (!hwdata->texture) {
+        TEX_DestroyRenderer(hwdata);
+        return -1;
+    }
+    hwdata->serial = SDL_VideoModeSerial;
+    return 0;
 }
 
-Uint8
-SDL_GetAppState(void)
+static int
+TEX_LockYUVOverlay(SDL_Overlay * overlay)
 {
-    Uint8 state = 0;
-    Uint32 flags = 0;
+    struct private_yuvhwdata *hwdata = overlay->hwdata;
+    void *pixels;
+    int pitch;
 
-    flags = SDL_GetWindowFlags(SDL_VideoWindow);
-    if ((flags & SDL_WINDOW_SHOWN) && !(flags & SDL_WINDOW_MINIMIZED)) {
-        state |= SDL_APPACTIVE;
+    /* The screen changed under us, nothing in the texture is worth keeping */
+    if (hwdata->serial != SDL_VideoModeSerial) {
+        if (TEX_CreateRenderer(overlay) < 0) {
+            return -1;
+        }
     }
-    if (flags & SDL_WINDOW_INPUT_FOCUS) {
-        state |= SDL_APPINPUTFOCUS;
+
+    if (SDL_LockTexture(hwdata->texture, NULL, &pixels, &pitch) < 0) {
+        return -1;
     }
-    if (flags & SDL_WINDOW_MOUSE_FOCUS) {
-        state |= SDL_APPMOUSEFOCUS;
+
+    /* Locked YUV textures are contiguous planes, chroma at half pitch */
+    hwdata->planes[0] = (Uint8 *) pixels;
+    hwdata->pitches[0] = pitch;
+    if (overlay->planes == 3) {
+        hwdata->pitches[1] = (pitch + 1) / 2;
+        hwdata->pitches[2] = (pitch + 1) / 2;
+        hwdata->planes[1] = hwdata->planes[0] + pitch * overlay->h;
+        hwdata->planes[2] = hwdata->planes[1] +
+            hwdata->pitches[1] * ((overlay->h + 1) / 2);
     }
-    return state;
+    return 0;
 }
 
-const SDL_version *
-SDL_Linked_Version(void)
+static void
+TEX_UnlockYUVOverlay(SDL_Overlay * overlay)
 {
-    static SDL_version version;
-    SDL_VERSION(&version);
-    return &version;
+    SDL_UnlockTexture(overlay->hwdata->texture);
 }
 
-int
-SDL_SetColors(SDL_Surface * surface, const SDL_Color * colors, int firstcolor,
-              int ncolors)
+static int
+TEX_DisplayYUVOverlay(SDL_Overlay * overlay, SDL_Rect * src, SDL_Rect * dst)
 {
-    if (SDL_SetPaletteColors
-        (surface->format->palette, colors, firstcolor, ncolors) == 0) {
-        return 1;
-    } else {
+    struct private_yuvhwdata *hwdata = overlay->hwdata;
+
+    /* The frame went with the old renderer, the next lock gets a new one */
+    if (hwdata->serial != SDL_VideoModeSerial) {
         return 0;
     }
-}
 
+    if (SDL_RenderCopy(hwdata->renderer, hwdata->texture, src, dst) < 0) {
+        return -1;
+    }
+    SDL_RenderPresent(hwdata->renderer);
 
-int
-SDL_SetPalette(SDL_Surface * surface, int flags, const SDL_Color * colors,
-               int firstcolor, int ncolors)
-{
-    return SDL_SetColors(surface, colors, firstcolor, ncolors);
+    SDL_UpdateRects(SDL_PublicSurface, 1, dst);
+    return 0;
 }
 
-int
-SDL_GetWMInfo(SDL_SysWMinfo * info)
+static void
+TEX_FreeYUVOverlay(SDL_Overlay * overlay)
 {
-    return SDL_GetWindowWMInfo(SDL_VideoWindow, info);
+    struct private_yuvhwdata *hwdata = overlay->hwdata;
+
+    if (hwdata) {
+        TEX_DestroyRenderer(hwdata);
+        SDL_free(hwdata);
+    }
 }
 
-// TODO: Implement this.
-// As the overlay stuff isn't used in Trine 2 (the reason I'm doing this),
-//  I've stubbed it out.
+static struct private_yuvhwfuncs tex_yuvfuncs = {
+    TEX_LockYUVOverlay,
+    TEX_UnlockYUVOverlay,
+    TEX_DisplayYUVOverlay,
+    TEX_FreeYUVOverlay
+};
+
+static SDL_Overlay *
+TEX_CreateYUVOverlay(int width, int height, Uint32 format)
+{
+    SDL_Overlay *overlay;
+    struct private_yuvhwdata *hwdata;
+
+    overlay = (SDL_Overlay *) SDL_calloc(1, sizeof(*overlay));
+    hwdata = (struct private_yuvhwdata *) SDL_calloc(1, sizeof(*hwdata));
+    if (!overlay || !hwdata) {
+        SDL_free(overlay);
+        SDL_free(hwdata);
+        SDL_OutOfMemory();
+        return NULL;
+    }
+    overlay->format = format;
+    overlay->w = width;
+    overlay->h = height;
+    overlay->planes = (format == SDL_YV12_OVERLAY ||
+                       format == SDL_IYUV_OVERLAY) ? 3 : 1;
+    overlay->hwfuncs = &tex_yuvfuncs;
+    overlay->hwdata = hwdata;
+    overlay->hw_overlay = 1;
+    overlay->pitches = hwdata->pitches;
+    overlay->pixels = hwdata->planes;
+
+    if (TEX_CreateRenderer(overlay) < 0) {
+        TEX_FreeYUVOverlay(overlay);
+        SDL_free(overlay);
+        return NULL;
+    }
+    return overlay;
+}
 
 SDL_Overlay *
 SDL_CreateYUVOverlay(int w, int h, Uint32 format, SDL_Surface * display)
 {
-    SDL_SetError("YUV overlays are not implemented in this version of SDL.");
-    return NULL;
+    SDL_Overlay *overlay = NULL;
+
+    if (!SDL_PublicSurface) {
+        SDL_SetError("No video mode has been set");
+        return NULL;
+    }
+    if (display != SDL_PublicSurface) {
+        SDL_SetError("YUV display is only supported on the screen surface");
+        return NULL;
+    }
+    if (w <= 0 || h <= 0) {
+        SDL_SetError("Invalid overlay size");
+        return NULL;
+    }
+
+    switch (format) {
+    case SDL_YV12_OVERLAY:
+    case SDL_IYUV_OVERLAY:
+    case SDL_YUY2_OVERLAY:
+    case SDL_UYVY_OVERLAY:
+    case SDL_YVYU_OVERLAY:
+        break;
+    default:
+        SDL_SetError("Unsupported YUV format");
+        return NULL;
+    }
+
+    /* OpenGL modes have no surface to draw into */
+    if (SDL_VideoFlags & SDL_OPENGL) {
+        SDL_SetError("YUV overlays are not supported in OpenGL mode");
+        return NULL;
+    }
+
+    /* Use a texture backed overlay if possible */
+    if (GetConfig()->yuv_hwaccel) {
+        overlay = TEX_CreateYUVOverlay(w, h, format);
+    }
+
+    /* If the texture overlay failed, fall back to software */
+    if (!overlay) {
+        overlay = SW_CreateYUVOverlay(w, h, format);
+    }
+    return overlay;
 }
 
 int
 SDL_LockYUVOverlay(SDL_Overlay * overlay)
 {
-    SDL_SetError("YUV overlays are not implemented in this version of SDL.");
-    return -1;
+    if (!overlay) {
+        SDL_SetError("Passed a NULL overlay");
+        return -1;
+    }
+    return overlay->hwfuncs->Lock(overlay);
 }
 
 void
 SDL_UnlockYUVOverlay(SDL_Overlay * overlay)
 {
-    SDL_SetError("YUV overlays are not implemented in this version of SDL.");
-    return;
+    if (!overlay) {
+        return;
+    }
+    overlay->hwfuncs->Unlock(overlay);
 }
 
 int
 SDL_DisplayYUVOverlay(SDL_Overlay * overlay, SDL_Rect * dstrect)
 {
-    SDL_SetError("YUV overlays are not implemented in this version of SDL.");
-    return -1;
+    SDL_Rect src, dst;
+    int srcx, srcy, srcw, srch;
+    int dstx, dsty, dstw, dsth;
+    COMPAT_TRACE("SDL_DisplayYUVOverlay");
+
+    if (!overlay || !dstrect) {
+        SDL_SetError("Passed NULL overlay or dstrect");
+        return -1;
+    }
+    if (!SDL_PublicSurface) {
+        SDL_SetError("No video mode has been set");
+        return -1;
+    }
+    if (dstrect->w <= 0 || dstrect->h <= 0) {
+        return 0;
+    }
+
+    /* Clip the rectangle to the screen area */
+    srcx = 0;
+    srcy = 0;
+    srcw = overlay->w;
+    srch = overlay->h;
+    dstx = dstrect->x;
+    dsty = dstrect->y;
+    dstw = dstrect->w;
+    dsth = dstrect->h;
+    if (dstx < 0) {
+        srcw += (dstx * overlay->w) / dstrect->w;
+        dstw += dstx;
+        srcx -= (dstx * overlay->w) / dstrect->w;
+        dstx = 0;
+    }
+    if ((dstx + dstw) > SDL_PublicSurface->w) {
+        int extra = (dstx + dstw - SDL_PublicSurface->w);
+        srcw -= (extra * overlay->w) / dstrect->w;
+        dstw -= extra;
+    }
+    if (dsty < 0) {
+        srch += (dsty * overlay->h) / dstrect->h;
+        dsth += dsty;
+        srcy -= (dsty * overlay->h) / dstrect->h;
+        dsty = 0;
+    }
+    if ((dsty + dsth) > SDL_PublicSurface->h) {
+        int extra = (dsty + dsth - SDL_PublicSurface->h);
+        srch -= (extra * overlay->h) / dstrect->h;
+        dsth -= extra;
+    }
+    if (srcw <= 0 || srch <= 0 || dstw <= 0 || dsth <= 0) {
+        return 0;
+    }
+    src.x = srcx;
+    src.y = srcy;
+    src.w = srcw;
+    src.h = srch;
+    dst.x = dstx;
+    dst.y = dsty;
+    dst.w = dstw;
+    dst.h = dsth;
+    return overlay->hwfuncs->Display(overlay, &src, &dst);
 }
 
 void
 SDL_FreeYUVOverlay(SDL_Overlay * overlay)
 {
-    SDL_SetError("YUV overlays are not implemented in this version of SDL.");
-    return;
+    if (!overlay) {
+        return;
+    }
+    if (overlay->hwfuncs) {
+        overlay->hwfuncs->FreeHW(overlay);
+    }
+    SDL_free(overlay);
 }
 
 void
 SDL_GL_SwapBuffers(void)
 {
+    COMPAT_TRACE("SDL_GL_SwapBuffers");
+
+    SDL_CountFlip();
     SDL_GL_SwapWindow(SDL_VideoWindow);
 }
 
@@ -1304,18 +5988,30 @@ SDL_GetGammaRamp(Uint16 * red, Uint16 * green, Uint16 * blue)
 int
 SDL_EnableKeyRepeat(int delay, int interval)
 {
+    if (delay < 0 || interval < 0) {
+        SDL_SetError("keyboard repeat value less than zero");
+        return -1;
+    }
+
+    SDL_AtomicLock(&SDL_KeyRepeat.lock);
+    SDL_KeyRepeat.delay = delay;
+    SDL_KeyRepeat.interval = interval;
+    SDL_KeyRepeat.held = SDL_FALSE;
+    SDL_AtomicUnlock(&SDL_KeyRepeat.lock);
     return 0;
 }
 
 void
 SDL_GetKeyRepeat(int *delay, int *interval)
 {
+    SDL_AtomicLock(&SDL_KeyRepeat.lock);
     if (delay) {
-        *delay = SDL_DEFAULT_REPEAT_DELAY;
+        *delay = SDL_KeyRepeat.delay;
     }
     if (interval) {
-        *interval = SDL_DEFAULT_REPEAT_INTERVAL;
+        *interval = SDL_KeyRepeat.interval;
     }
+    SDL_AtomicUnlock(&SDL_KeyRepeat.lock);
 }
 
 int
@@ -1361,6 +6057,20 @@ SDL_SetTimer(Uint32 interval, SDL_OldTimerCallback callback)
     return 0;
 }
 
+/* Changes to variables we read take effect the next time they're used */
+int
+SDL_setenv(const char *name, const char *value, int overwrite)
+{
+    int retval = SDL2_setenv(name, value, overwrite);
+
+    if (retval == 0 && name &&
+        (SDL_strncmp(name, "SDL_VIDEO_", 10) == 0 ||
+         SDL_strncmp(name, "SDL_COMPAT_", 11) == 0)) {
+        SDL_ConfigStale = SDL_TRUE;
+    }
+    return retval;
+}
+
 int
 SDL_putenv(const char *_var)
 {
@@ -1382,4 +6092,49 @@ SDL_putenv(const char *_var)
     return 0;
 }
 
+/* The SDL 2.0 function a wrapper calls on to.  Without it the wrapper
+ *  would jump to NULL on its first call, so give up right away instead.
+ */
+static void *
+LoadSDL2Function(const char *name)
+{
+    void *function = dlsym(RTLD_NEXT, name);
+
+    if (!function) {
+        fprintf(stderr, "SDL_compat: can't find SDL 2.0's %s: %s\n",
+                name, dlerror());
+        abort();
+    }
+    return function;
+}
+
+/* Runs when the library is loaded */
+static void __attribute__((constructor))
+SDL_CompatInit(void)
+{
+    SDL2_PumpEvents = LoadSDL2Function("SDL_PumpEvents");
+    SDL2_WaitEventTimeout = LoadSDL2Function("SDL_WaitEventTimeout");
+    SDL2_PeepEvents = LoadSDL2Function("SDL_PeepEvents");
+    SDL2_HasEvents = LoadSDL2Function("SDL_HasEvents");
+    SDL2_FlushEvents = LoadSDL2Function("SDL_FlushEvents");
+    SDL2_EventState = LoadSDL2Function("SDL_EventState");
+    SDL2_Init = LoadSDL2Function("SDL_Init");
+    SDL2_InitSubSystem = LoadSDL2Function("SDL_InitSubSystem");
+    SDL2_QuitSubSystem = LoadSDL2Function("SDL_QuitSubSystem");
+    SDL2_Quit = LoadSDL2Function("SDL_Quit");
+    SDL2_setenv = LoadSDL2Function("SDL_setenv");
+
+    SDL_LoadCounter = SDL_GetPerformanceCounter();
+    SDL_InitTrace();
+    SDL_InitMetrics();
+    SDL_InitCPUFeatures();
+    SDL_InitYUVKernels();
+}
+
+static void __attribute__((destructor))
+SDL_CompatQuit(void)
+{
+    SDL_QuitMetrics();
+}
+
 /* vi: set ts=4 sw=4 expandtab: */
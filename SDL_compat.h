@@ -307,6 +307,18 @@ extern DECLSPEC int SDLCALL SDL_SetAlpha(SDL_Surface * surface,
 extern DECLSPEC SDL_Surface *SDLCALL SDL_DisplayFormat(SDL_Surface * surface);
 extern DECLSPEC SDL_Surface *SDLCALL SDL_DisplayFormatAlpha(SDL_Surface *
                                                             surface);
+/**
+ *  Converts an array of surfaces with SDL_DisplayFormat(), or with
+ *  SDL_DisplayFormatAlpha() if \c alpha is nonzero, spread over worker
+ *  threads.  The surfaces must all be different.
+ *
+ *  \return A new array of the converted surfaces, with NULL where that
+ *          conversion failed, to be freed with SDL_free(), or NULL on error.
+ */
+extern DECLSPEC SDL_Surface **SDLCALL SDL_DisplayFormatArray(SDL_Surface **
+                                                             surfaces,
+                                                             int numsurfaces,
+                                                             int alpha);
 extern DECLSPEC void SDLCALL SDL_WM_SetCaption(const char *title,
                                                const char *icon);
 extern DECLSPEC void SDLCALL SDL_WM_GetCaption(const char **title,
@@ -0,0 +1,95 @@
+/*
+  Simple DirectMedia Layer
+  Copyright (C) 1997-2012 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+/**
+ *  \file SDL_compat_metrics.h
+ *
+ *  Layout of the live metrics page the compatibility layer keeps in shared
+ *  memory, named COMPAT_METRICS_NAME with the process ID filled in.
+ *
+ *  Counters only ever go up, readers take differences between samples.
+ *  Only plain C types are used, so tools/sdl-top doesn't need SDL, and the
+ *  layout is the same for 32-bit and 64-bit processes.
+ */
+
+#ifndef _SDL_compat_metrics_h
+#define _SDL_compat_metrics_h
+
+#include <stdint.h>
+
+#define COMPAT_METRICS_MAGIC    0x4D4C4453      /* "SDLM" */
+#define COMPAT_METRICS_VERSION  6
+#define COMPAT_METRICS_NAME     "/sdl-compat-%d"
+
+/* Histogram bucket i counts times in [2^i, 2^(i+1)) microseconds */
+#define COMPAT_METRICS_BUCKETS  24
+
+/* SDL 2.0 events seen by the compatibility event filter */
+enum
+{
+    COMPAT_EVENT_WINDOW,
+    COMPAT_EVENT_KEY,
+    COMPAT_EVENT_TEXT,
+    COMPAT_EVENT_MOTION,
+    COMPAT_EVENT_BUTTON,
+    COMPAT_EVENT_WHEEL,
+    COMPAT_EVENT_OTHER,
+    COMPAT_EVENT_TYPES
+};
+
+/* SDL 1.2 events synthesized from them */
+enum
+{
+    COMPAT_SYNTH_EXPOSE,
+    COMPAT_SYNTH_RESIZE,
+    COMPAT_SYNTH_ACTIVE,
+    COMPAT_SYNTH_QUIT,
+    COMPAT_SYNTH_BUTTON,
+    COMPAT_SYNTH_REPEAT,
+    COMPAT_SYNTH_TYPES
+};
+
+typedef struct SDL_CompatMetrics
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint32_t size;              /* sizeof(SDL_CompatMetrics) */
+
+    uint64_t frames;            /* Updates that reached the screen */
+    uint64_t flips;             /* SDL_Flip and SDL_GL_SwapBuffers calls */
+    uint64_t rects;             /* Rectangles in them, after coalescing */
+    uint64_t convert_bytes;     /* Written converting the shadow surface */
+    uint64_t present_us;        /* Total time spent presenting */
+    uint64_t present_hist[COMPAT_METRICS_BUCKETS];
+    uint64_t interval_hist[COMPAT_METRICS_BUCKETS];     /* Between presents */
+    uint64_t first_frame_us;    /* From loading to the first flip or swap */
+    uint64_t rle_surfaces;      /* Converted or SDL_SetAlpha'd with RLE */
+    uint64_t plain_surfaces;    /* ... and without, as it wouldn't pay */
+    uint64_t toggle_us;         /* The last SDL_WM_ToggleFullScreen */
+
+    uint64_t events[COMPAT_EVENT_TYPES];
+    uint64_t synthesized[COMPAT_SYNTH_TYPES];
+} SDL_CompatMetrics;
+
+#endif /* _SDL_compat_metrics_h */
+
+/* vi: set ts=4 sw=4 expandtab: */
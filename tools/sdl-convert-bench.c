@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+
+/* Just the start of SDL 2.0's SDL_PixelFormat and SDL_Surface, all we
+   look at */
+typedef struct SDL_PixelFormat {
+    uint32_t format;
+    void *palette;
+    uint8_t BitsPerPixel;
+    uint8_t BytesPerPixel;
+    uint8_t padding[2];
+    uint32_t Rmask, Gmask, Bmask, Amask;
+} SDL_PixelFormat;
+
+typedef struct SDL_Surface {
+    uint32_t flags;
+    SDL_PixelFormat *format;
+    int w, h;
+    int pitch;
+    void *pixels;
+} SDL_Surface;
+
+typedef struct SDL_Rect {
+    int x, y;
+    int w, h;
+} SDL_Rect;
+
+#define SDL_INIT_VIDEO 0x00000020
+
+int (*SDL_Init)(uint32_t flags);
+void (*SDL_Quit)(void);
+SDL_Surface * (*SDL_SetVideoMode)(int w, int h, int bpp, uint32_t flags);
+SDL_Surface * (*SDL_CreateRGBSurface)(uint32_t flags, int w, int h, int depth,
+                                      uint32_t rmask, uint32_t gmask,
+                                      uint32_t bmask, uint32_t amask);
+void (*SDL_FreeSurface)(SDL_Surface *surface);
+int (*SDL_SetColorKey)(SDL_Surface *surface, int flag, uint32_t key);
+int (*SDL_GetColorKey)(SDL_Surface *surface, uint32_t *key);
+int (*SDL_GetSurfaceBlendMode)(SDL_Surface *surface, int *mode);
+int (*SDL_SetClipRect)(SDL_Surface *surface, const SDL_Rect *rect);
+void (*SDL_GetClipRect)(SDL_Surface *surface, SDL_Rect *rect);
+int (*SDL_LockSurface)(SDL_Surface *surface);
+void (*SDL_UnlockSurface)(SDL_Surface *surface);
+SDL_Surface * (*SDL_ConvertSurface)(SDL_Surface *src, SDL_PixelFormat *fmt,
+                                    uint32_t flags);
+SDL_Surface * (*SDL_DisplayFormat)(SDL_Surface *surface);
+SDL_Surface * (*SDL_DisplayFormatAlpha)(SDL_Surface *surface);
+
+static struct {
+    const char *name;
+    int depth;
+    uint32_t rmask, gmask, bmask, amask;
+} formats[] = {
+    { "RGB24", 24, 0x000000ff, 0x0000ff00, 0x00ff0000, 0 },
+    { "BGR24", 24, 0x00ff0000, 0x0000ff00, 0x000000ff, 0 },
+    { "RGBA8888", 32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000 },
+    { "XRGB8888", 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0 },
+    { "RGB565", 16, 0xf800, 0x07e0, 0x001f, 0 },
+    { "INDEX8", 8, 0, 0, 0, 0 },
+};
+
+void *load_symbol(void *sdl, const char *name)
+{
+    void *symbol = dlsym(sdl, name);
+    if (symbol == NULL) {
+        fprintf(stderr, "%s: %s\n", name, dlerror());
+        exit(-1);
+    }
+    return symbol;
+}
+
+void load_symbols(const char *lib)
+{
+    void *sdl = dlopen(lib, RTLD_NOW | RTLD_GLOBAL);
+    if (sdl == NULL) {
+        fprintf(stderr, "%s\n", dlerror());
+        exit(-1);
+    }
+
+    SDL_Init = load_symbol(sdl, "SDL_Init");
+    SDL_Quit = load_symbol(sdl, "SDL_Quit");
+    SDL_SetVideoMode = load_symbol(sdl, "SDL_SetVideoMode");
+    SDL_CreateRGBSurface = load_symbol(sdl, "SDL_CreateRGBSurface");
+    SDL_FreeSurface = load_symbol(sdl, "SDL_FreeSurface");
+    SDL_SetColorKey = load_symbol(sdl, "SDL_SetColorKey");
+    SDL_GetColorKey = load_symbol(sdl, "SDL_GetColorKey");
+    SDL_GetSurfaceBlendMode = load_symbol(sdl, "SDL_GetSurfaceBlendMode");
+    SDL_SetClipRect = load_symbol(sdl, "SDL_SetClipRect");
+    SDL_GetClipRect = load_symbol(sdl, "SDL_GetClipRect");
+    SDL_LockSurface = load_symbol(sdl, "SDL_LockSurface");
+    SDL_UnlockSurface = load_symbol(sdl, "SDL_UnlockSurface");
+    SDL_ConvertSurface = load_symbol(sdl, "SDL_ConvertSurface");
+    SDL_DisplayFormat = load_symbol(sdl, "SDL_DisplayFormat");
+    SDL_DisplayFormatAlpha = load_symbol(sdl, "SDL_DisplayFormatAlpha");
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Whether SDL_DisplayFormat(Alpha) gives what SDL_ConvertSurface() does,
+   pixels, colorkey, blend mode and clip rectangle */
+static int matches(SDL_Surface *sprite, int alpha)
+{
+    SDL_Surface *fast = alpha ? SDL_DisplayFormatAlpha(sprite) :
+        SDL_DisplayFormat(sprite);
+    SDL_Surface *slow = SDL_ConvertSurface(sprite, fast->format, 0);
+    const SDL_PixelFormat *format = fast->format;
+    /* Padding bytes are whatever the converter likes */
+    uint32_t mask = format->Amask ? 0xffffffff :
+        (format->Rmask | format->Gmask | format->Bmask);
+    uint32_t fast_key = 0, slow_key = 0;
+    int fast_mode, slow_mode;
+    SDL_Rect fast_clip, slow_clip;
+    int same = 1;
+
+    if (SDL_GetColorKey(fast, &fast_key) != SDL_GetColorKey(slow, &slow_key) ||
+        fast_key != slow_key) {
+        same = 0;
+    }
+    SDL_GetSurfaceBlendMode(fast, &fast_mode);
+    SDL_GetSurfaceBlendMode(slow, &slow_mode);
+    SDL_GetClipRect(fast, &fast_clip);
+    SDL_GetClipRect(slow, &slow_clip);
+    if (fast_mode != slow_mode ||
+        memcmp(&fast_clip, &slow_clip, sizeof(fast_clip)) != 0) {
+        same = 0;
+    }
+
+    /* Either might have been RLE encoded */
+    SDL_LockSurface(fast);
+    SDL_LockSurface(slow);
+    for (int y = 0; y < fast->h && same; ++y) {
+        const uint32_t *a = (const uint32_t *)
+            ((const uint8_t *)fast->pixels + y * fast->pitch);
+        const uint32_t *b = (const uint32_t *)
+            ((const uint8_t *)slow->pixels + y * slow->pitch);
+        for (int x = 0; x < fast->w; ++x) {
+            if ((a[x] & mask) != (b[x] & mask)) {
+                same = 0;
+                break;
+            }
+        }
+    }
+    SDL_UnlockSurface(slow);
+    SDL_UnlockSurface(fast);
+
+    SDL_FreeSurface(slow);
+    SDL_FreeSurface(fast);
+    return same;
+}
+
+/* Megapixels per second converting the sprite over and over */
+static double throughput(SDL_Surface *sprite, int alpha, SDL_PixelFormat *format)
+{
+    double start = now(), elapsed;
+    int runs = 0;
+
+    do {
+        SDL_Surface *converted;
+        if (format) {
+            converted = SDL_ConvertSurface(sprite, format, 0);
+        } else if (alpha) {
+            converted = SDL_DisplayFormatAlpha(sprite);
+        } else {
+            converted = SDL_DisplayFormat(sprite);
+        }
+        SDL_FreeSurface(converted);
+        ++runs;
+        elapsed = now() - start;
+    } while (elapsed < 0.25);
+    return (double)sprite->w * sprite->h * runs / elapsed / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int size = 256;
+
+    switch (argc) {
+    case 3:
+        size = atoi(argv[2]);
+    case 2:
+        break;
+    case 1:
+    case 0:
+        printf("usage: sdl-convert-bench <SDL_compat sofile> [sprite size]\n");
+        printf("Set SDL_VIDEODRIVER=dummy to run it headless.\n");
+        return -1;
+    }
+
+    load_symbols(argv[1]);
+    if (SDL_Init(SDL_INIT_VIDEO) < 0 || !SDL_SetVideoMode(640, 480, 32, 0)) {
+        fprintf(stderr, "couldn't set a video mode\n");
+        return -1;
+    }
+
+    int failed = 0;
+    printf("%dx%d sprites, Mpixels/s\n", size, size);
+    printf("%-10s %-9s %12s %12s %12s  %s\n", "source", "colorkey",
+        "DisplayFmt", "DisplayAlpha", "SDL2 generic", "same as SDL2");
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        for (int colorkey = 0; colorkey < 2; ++colorkey) {
+            SDL_Surface *sprite = SDL_CreateRGBSurface(0, size, size,
+                formats[i].depth, formats[i].rmask, formats[i].gmask,
+                formats[i].bmask, formats[i].amask);
+            if (sprite == NULL) {
+                continue;
+            }
+            for (int y = 0; y < sprite->h; ++y) {
+                uint8_t *row = (uint8_t *)sprite->pixels + y * sprite->pitch;
+                for (int x = 0; x < sprite->pitch; ++x) {
+                    row[x] = rand();
+                }
+            }
+            if (colorkey) {
+                SDL_SetColorKey(sprite, 1, 0);
+            }
+            SDL_Rect clip = { 1, 2, size - 3, size - 5 };
+            SDL_SetClipRect(sprite, &clip);
+
+            int same = matches(sprite, 0) && matches(sprite, 1);
+            failed += !same;
+
+            /* The generic path converts to the same format the alpha one does */
+            SDL_Surface *target = SDL_DisplayFormatAlpha(sprite);
+            printf("%-10s %-9s %12.1f %12.1f %12.1f  %s\n", formats[i].name,
+                colorkey ? "yes" : "no",
+                throughput(sprite, 0, NULL),
+                throughput(sprite, 1, NULL),
+                throughput(sprite, 1, target->format),
+                same ? "yes" : "NO");
+            SDL_FreeSurface(target);
+            SDL_FreeSurface(sprite);
+        }
+    }
+    SDL_Quit();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+/* Checks the pixel conversion kernels against SDL_BlitSurface, byte for
+ * byte, for every format pair they cover and every instruction set this
+ * CPU has.  The kernels are static, so this builds SDL_compat.c in.
+ */
+#include "../SDL_compat.c"
+
+static const Uint32 sources[] = {
+    SDL_PIXELFORMAT_RGB565, SDL_PIXELFORMAT_RGB555,
+    SDL_PIXELFORMAT_RGB24, SDL_PIXELFORMAT_BGR24,
+    SDL_PIXELFORMAT_RGB888, SDL_PIXELFORMAT_BGR888,
+    SDL_PIXELFORMAT_ARGB8888, SDL_PIXELFORMAT_ABGR8888,
+    SDL_PIXELFORMAT_RGBA8888, SDL_PIXELFORMAT_BGRA8888,
+};
+
+static const Uint32 targets[] = {
+    SDL_PIXELFORMAT_RGB888, SDL_PIXELFORMAT_BGR888,
+    SDL_PIXELFORMAT_ARGB8888, SDL_PIXELFORMAT_ABGR8888,
+    SDL_PIXELFORMAT_RGBA8888, SDL_PIXELFORMAT_BGRA8888,
+};
+
+static const struct {
+    const char *name;
+    int features;
+} levels[] = {
+    { "AVX2", COMPAT_CPU_AVX2 | COMPAT_CPU_SSSE3 | COMPAT_CPU_SSE2 },
+    { "SSSE3", COMPAT_CPU_SSSE3 | COMPAT_CPU_SSE2 },
+    { "SSE2", COMPAT_CPU_SSE2 },
+};
+
+/* Padding bytes are whatever the converter likes, only compare channels */
+static int compare(SDL_Surface *converted, SDL_Surface *blitted,
+                   const SDL_Rect *rect)
+{
+    const SDL_PixelFormat *format = converted->format;
+    Uint32 mask = format->Amask ? 0xffffffff :
+        (format->Rmask | format->Gmask | format->Bmask);
+    int x, y, wrong = 0;
+
+    for (y = rect->y; y < rect->y + rect->h; ++y) {
+        const Uint32 *a = (const Uint32 *)
+            ((const Uint8 *) converted->pixels + y * converted->pitch);
+        const Uint32 *b = (const Uint32 *)
+            ((const Uint8 *) blitted->pixels + y * blitted->pitch);
+        for (x = rect->x; x < rect->x + rect->w; ++x) {
+            if ((a[x] & mask) != (b[x] & mask)) {
+                if (wrong++ == 0) {
+                    printf("    first difference at %d,%d: %08x, SDL %08x\n",
+                           x, y, a[x], b[x]);
+                }
+            }
+        }
+    }
+    return wrong;
+}
+
+static int check(Uint32 source, Uint32 target, const char *level,
+                 SDL_bool stream)
+{
+    SDL_PixelKernel kernel;
+    SDL_Surface *src, *converted, *blitted;
+    SDL_Rect rect;
+    int x, y, wrong;
+
+    src = SDL_CreateRGBSurfaceWithFormat(0, 77, 33, 0, source);
+    converted = SDL_CreateRGBSurfaceWithFormat(0, 77, 33, 0, target);
+    blitted = SDL_CreateRGBSurfaceWithFormat(0, 77, 33, 0, target);
+    if (!src || !converted || !blitted) {
+        printf("%s\n", SDL_GetError());
+        exit(-1);
+    }
+    if (!SDL_ChoosePixelKernel(&kernel, src->format, converted->format)) {
+        SDL_FreeSurface(src);
+        SDL_FreeSurface(converted);
+        SDL_FreeSurface(blitted);
+        return 0;
+    }
+
+    for (y = 0; y < src->h; ++y) {
+        Uint8 *row = (Uint8 *) src->pixels + y * src->pitch;
+        for (x = 0; x < src->pitch; ++x) {
+            row[x] = rand();
+        }
+    }
+
+    /* Odd sizes and offsets, for the unaligned heads and tails */
+    rect.x = 3;
+    rect.y = 2;
+    rect.w = src->w - 8;
+    rect.h = src->h - 4;
+    SDL_ConvertPixelRect(&kernel, src, converted, &rect, stream);
+    SDL_SetSurfaceBlendMode(src, SDL_BLENDMODE_NONE);
+    SDL_BlitSurface(src, &rect, blitted, &rect);
+
+    wrong = compare(converted, blitted, &rect);
+    printf("%-24s -> %-24s %-6s %-6s %s\n",
+           SDL_GetPixelFormatName(source), SDL_GetPixelFormatName(target),
+           level, stream ? "stream" : "store", wrong ? "DIFFERENT" : "ok");
+
+    SDL_FreeSurface(src);
+    SDL_FreeSurface(converted);
+    SDL_FreeSurface(blitted);
+    return wrong ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int detected = SDL_CompatCPUFeatures;
+    int failed = 0;
+    size_t i, j, k;
+
+    for (k = 0; k < SDL_arraysize(levels); ++k) {
+        if (levels[k].features & ~detected) {
+            printf("%s: not supported by this CPU, skipped\n", levels[k].name);
+            continue;
+        }
+        SDL_CompatCPUFeatures = levels[k].features;
+        for (i = 0; i < SDL_arraysize(sources); ++i) {
+            for (j = 0; j < SDL_arraysize(targets); ++j) {
+                failed += check(sources[i], targets[j], levels[k].name, SDL_FALSE);
+                failed += check(sources[i], targets[j], levels[k].name, SDL_TRUE);
+            }
+        }
+    }
+    SDL_CompatCPUFeatures = detected;
+
+    printf("%d conversions differ from SDL_BlitSurface\n", failed);
+    return failed ? 1 : 0;
+}
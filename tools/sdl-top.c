@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "SDL_compat_metrics.h"
+
+static const char *event_names[COMPAT_EVENT_TYPES] = {
+    "window", "key", "text", "motion", "button", "wheel", "other"
+};
+
+static const char *synth_names[COMPAT_SYNTH_TYPES] = {
+    "expose", "resize", "active", "quit", "button", "key repeat"
+};
+
+/* The library updates the page as we read it, take counters one by one */
+static void snapshot(const SDL_CompatMetrics *page, SDL_CompatMetrics *copy)
+{
+    const uint64_t *src = &page->frames;
+    uint64_t *dst = &copy->frames;
+    size_t i, n = (sizeof(*page) - offsetof(SDL_CompatMetrics, frames)) / sizeof(uint64_t);
+
+    for (i = 0; i < n; ++i) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+/* Upper bound of the bucket the given fraction of samples fall under, in ms */
+static double percentile(const uint64_t *now, const uint64_t *then, double fraction)
+{
+    uint64_t total = 0, seen = 0;
+    int i;
+
+    for (i = 0; i < COMPAT_METRICS_BUCKETS; ++i) {
+        total += now[i] - then[i];
+    }
+    if (total == 0) {
+        return 0.0;
+    }
+    for (i = 0; i < COMPAT_METRICS_BUCKETS; ++i) {
+        seen += now[i] - then[i];
+        if (seen >= total * fraction) {
+            break;
+        }
+    }
+    return (double)(2ull << i) / 1000.0;
+}
+
+static void list_pages(void)
+{
+    DIR *dir = opendir("/dev/shm");
+    struct dirent *entry;
+    int pid;
+
+    if (dir == NULL) {
+        perror("/dev/shm");
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, COMPAT_METRICS_NAME + 1, &pid) == 1) {
+            printf("%d%s\n", pid, kill(pid, 0) == 0 ? "" : " (exited)");
+        }
+    }
+    closedir(dir);
+}
+
+static const SDL_CompatMetrics *attach(int pid)
+{
+    char name[32];
+    void *page;
+    int fd;
+
+    snprintf(name, sizeof(name), COMPAT_METRICS_NAME, pid);
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        perror(name);
+        exit(-1);
+    }
+    page = mmap(NULL, sizeof(SDL_CompatMetrics), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        perror(name);
+        exit(-1);
+    }
+    return page;
+}
+
+int main(int argc, char **argv)
+{
+    switch (argc) {
+    case 2:
+        break;
+    case 1:
+    case 0:
+        printf("usage: sdl-top <pid>\n");
+        printf("Start the program with SDL_COMPAT_METRICS=1 to watch it.\n");
+        printf("running SDL_compat processes:\n");
+        list_pages();
+        return -1;
+    }
+
+    int pid = atoi(argv[1]);
+    const SDL_CompatMetrics *page = attach(pid);
+    if (page->magic != COMPAT_METRICS_MAGIC ||
+        page->version != COMPAT_METRICS_VERSION ||
+        page->size != sizeof(SDL_CompatMetrics)) {
+        printf("%d doesn't have a metrics page this sdl-top understands\n", pid);
+        return -1;
+    }
+
+    SDL_CompatMetrics then, now;
+    snapshot(page, &then);
+    while (kill(pid, 0) == 0) {
+        sleep(1);
+        snapshot(page, &now);
+
+        uint64_t presents = now.frames - then.frames;
+        printf("\033[H\033[2J");
+        printf("sdl-top - pid %d\n\n", pid);
+        printf("frames/s       %8llu\n",
+            (unsigned long long)(now.flips - then.flips));
+        printf("presents/s     %8llu\n", (unsigned long long)presents);
+        printf("rects/present  %8.1f\n",
+            presents ? (double)(now.rects - then.rects) / presents : 0.0);
+        printf("convert MB/s   %8.1f\n",
+            (double)(now.convert_bytes - then.convert_bytes) / (1024 * 1024));
+        printf("present ms     %8.2f avg  %6.2f p50  %6.2f p95  %6.2f p99\n",
+            presents ? (double)(now.present_us - then.present_us) / presents / 1000.0 : 0.0,
+            percentile(now.present_hist, then.present_hist, 0.50),
+            percentile(now.present_hist, then.present_hist, 0.95),
+            percentile(now.present_hist, then.present_hist, 0.99));
+        printf("present gap ms           %6.2f p50  %6.2f p95  %6.2f p99\n",
+            percentile(now.interval_hist, then.interval_hist, 0.50),
+            percentile(now.interval_hist, then.interval_hist, 0.95),
+            percentile(now.interval_hist, then.interval_hist, 0.99));
+        if (now.first_frame_us) {
+            printf("first frame ms %8.1f\n", (double)now.first_frame_us / 1000.0);
+        }
+        if (now.toggle_us) {
+            printf("fullscreen ms  %8.2f last toggle\n", (double)now.toggle_us / 1000.0);
+        }
+        printf("RLE surfaces   %8llu of %llu\n",
+            (unsigned long long)now.rle_surfaces,
+            (unsigned long long)(now.rle_surfaces + now.plain_surfaces));
+
+        printf("\nevents/s\n");
+        for (int i = 0; i < COMPAT_EVENT_TYPES; ++i) {
+            printf("  %-12s %8llu\n", event_names[i],
+                (unsigned long long)(now.events[i] - then.events[i]));
+        }
+        printf("\nsynthesized/s\n");
+        for (int i = 0; i < COMPAT_SYNTH_TYPES; ++i) {
+            printf("  %-12s %8llu\n", synth_names[i],
+                (unsigned long long)(now.synthesized[i] - then.synthesized[i]));
+        }
+        fflush(stdout);
+        then = now;
+    }
+    printf("%d exited\n", pid);
+    return 0;
+}